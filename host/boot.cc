@@ -0,0 +1,133 @@
+// Boot times for the normal and BOOT=fast builds.
+//
+//   boot [-k knob]
+//
+// Boots each build in manual mode and prints, from reset, when the
+// PWM pin first goes high with the kick in OCR0A and when it first
+// runs at the knob's setting, with the phases in between:
+//
+//   reset   the SUT fuses' start-up delay
+//   init    avr-libc startup and init() up to starting Timer0
+//   edge    until Timer0 first reaches BOTTOM and sets the pin
+//   kick    the kick, from the first edge to the knob's write
+//   latch   until OCR0A takes the write at the next BOTTOM
+//
+// The start-up delays are nominal at 5V.  The watchdog oscillator
+// that times them is slower at lower voltages.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+
+class Writes : public sim::Output
+{
+public:
+  std::vector<uint64_t> cycles;
+
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    cycles.push_back(cycle);
+  }
+};
+
+static void
+run_normal(sim::FastBootSim& hw)
+{
+  spiro::Spiro<sim::Sim>(hw).run();
+}
+
+static void
+run_fast(sim::FastBootSim& hw)
+{
+  spiro::Spiro<sim::FastBootSim>(hw).run();
+}
+
+// Each build gets a FastBootSim, which behaves as a plain Sim unless
+// run as one.
+struct Build
+{
+  const char* name;
+  double reset;			// s
+  void (*run)(sim::FastBootSim&);
+};
+
+static const Build builds[] = {
+  { "normal", 0.064, run_normal },	// SUT = 10, 14CK + 64ms.
+  { "fast", 0.004, run_fast },		// SUT = 01, 14CK + 4ms.
+};
+
+// The first BOTTOM at or after cycle.
+static uint64_t
+bottom(const sim::Sim& hw, uint64_t cycle)
+{
+  if (cycle <= hw.timer0_bottom) {
+    return hw.timer0_bottom;
+  }
+  uint64_t periods = (cycle - hw.timer0_bottom + sim::pwm_period - 1)
+    / sim::pwm_period;
+  return hw.timer0_bottom + periods * sim::pwm_period;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: boot [-k knob]\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  int knob = 128;
+
+  int c;
+  while ((c = getopt(argc, argv, "k:")) != -1) {
+    switch (c) {
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || knob < 0 || knob > 255) {
+    usage();
+  }
+
+  printf("%-8s %8s %8s %8s %8s %8s %9s %11s\n", "build", "reset_ms",
+	 "init_ms", "edge_ms", "kick_ms", "latch_ms", "to_edge", "to_setpoint");
+  for (const Build& build : builds) {
+    sim::FastBootSim hw(sim::cycles(1));
+    hw.knob = knob;
+    Writes writes;
+    hw.output = &writes;
+    try {
+      build.run(hw);
+    }
+    catch (sim::Sim::Done&) {
+    }
+    if (writes.cycles.size() < 2) {
+      fprintf(stderr, "boot: %s never left the kick\n", build.name);
+      return 1;
+    }
+
+    // The first write is the kick, the second the knob's setting.
+    uint64_t started = hw.timer0_started;
+    uint64_t edge = bottom(hw, writes.cycles[0]);
+    uint64_t setpoint = bottom(hw, writes.cycles[1]);
+    double ms = 1000 / (double)sim::cpu_hz;
+    printf("%-8s %8.3f %8.3f %8.3f %8.3f %8.3f %8.3fms %9.3fms\n",
+	   build.name, 1000 * build.reset, started * ms,
+	   (edge - started) * ms, (writes.cycles[1] - edge) * ms,
+	   (setpoint - writes.cycles[1]) * ms,
+	   1000 * build.reset + edge * ms,
+	   1000 * build.reset + setpoint * ms);
+  }
+
+  return 0;
+}
@@ -0,0 +1,126 @@
+// Drive the motor and fan model from the firmware and report how the
+// fan responds.
+//
+//   fansim [-t seconds] [-k knob] [-s] [-r rate] [script]
+//   fansim [-t seconds] -l log
+//
+// The first form runs the control logic against an input script (see
+// script.h), or a fixed knob and switch, as a SLEW=rate build with
+// -r.  The second replays a log of "cycle pwm" OCR0A writes, as
+// printed by spirosim, from some other build of the firmware.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "spiro.h"
+#include "sim.h"
+#include "script.h"
+#include "motor.h"
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+	  "usage: fansim [-t seconds] [-k knob] [-s] [-r rate] [script]\n"
+	  "       fansim [-t seconds] -l log\n");
+  exit(2);
+}
+
+// Returns false if the log is malformed.
+static bool
+replay(const char* filename, sim::Rig& rig, uint64_t end)
+{
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  unsigned long long cycle;
+  unsigned pwm;
+  int n;
+  while ((n = fscanf(f, "%llu %u", &cycle, &pwm)) == 2 && cycle < end) {
+    if (pwm > 255) {
+      break;
+    }
+    rig.pwm(cycle, pwm);
+  }
+  bool ok = n == EOF || (n == 2 && cycle >= end);
+  if (!ok) {
+    fprintf(stderr, "%s: bad log\n", filename);
+  }
+  fclose(f);
+  rig.run(end);
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 10;
+  int knob = 128;
+  bool sw = false;
+  int rate = 0;
+  const char* log = nullptr;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:sr:l:")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    case 's':
+      sw = true;
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    case 'l':
+      log = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind > (log ? 0 : 1) || knob < 0 || knob > 255
+      || rate < 0 || rate > 0xF0) {
+    usage();
+  }
+
+  uint64_t end = sim::cycles(seconds);
+  sim::Rig rig;
+
+  if (log) {
+    if (!replay(log, rig, end)) {
+      return 1;
+    }
+  }
+  else {
+    sim::Sim hw(end);
+    hw.knob = knob;
+    hw.sw = sw;
+    hw.slew_rate = rate;
+    hw.output = &rig;
+
+    sim::Script script;
+    if (optind < argc) {
+      if (!script.load(argv[optind])) {
+	return 1;
+      }
+      hw.input = &script;
+    }
+
+    try {
+      spiro::Spiro<sim::Sim>(hw).run();
+    }
+    catch (sim::Sim::Done&) {
+    }
+    rig.run(end);
+  }
+
+  rig.print(stdout);
+  return 0;
+}
@@ -0,0 +1,233 @@
+// Overcurrent and stall protection in a SENSE=1 build, against the
+// fan model with faults injected from a file.
+//
+//   fault [-t seconds] [-k knob] [-s] [-r ohms] faults
+//
+// The faults file has one line per change, like a script (see
+// script.h):
+//
+//   # seconds fault
+//   2    stall		hold the rotor still
+//   4    clear		back to normal
+//   6    short 1	short the winding down to 1 ohm
+//
+// The shunt is -r ohms (default 1) on ADC1, read against the supply.
+// Prints each cut and restore of the output, then for each fault the
+// time from it to the first cut, the detection latency.  Faults that
+// come while the output is already cut, waiting out the backoff
+// from an earlier one, aren't timed.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "motor.h"
+
+struct Fault
+{
+  uint64_t cycle;
+  bool stall;
+  double short_r;		// 0 for none.
+};
+
+// Applies the faults to the motor as time reaches them and reads the
+// shunt.
+class Faults : public sim::Input
+{
+public:
+  Faults(sim::Rig& rig, double ohms)
+    : rig(rig), ohms(ohms)
+  {
+  }
+
+  std::vector<Fault> faults;
+
+  // Returns false and prints a message if the file can't be read.
+  bool
+  load(const char* filename)
+  {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+      perror(filename);
+      return false;
+    }
+    char line[256];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof line, f)) {
+      lineno++;
+      char* hash = strchr(line, '#');
+      if (hash) {
+	*hash = '\0';
+      }
+      double t;
+      char what[16];
+      double r = 0;
+      int n = sscanf(line, "%lf %15s %lf", &t, what, &r);
+      if (n == EOF) {
+	continue;
+      }
+      Fault fault{sim::cycles(t), false, 0};
+      if (n == 2 && strcmp(what, "stall") == 0) {
+	fault.stall = true;
+      }
+      else if (n == 3 && strcmp(what, "short") == 0 && r > 0) {
+	fault.short_r = r;
+      }
+      else if (n != 2 || strcmp(what, "clear") != 0) {
+	ok = false;
+      }
+      if (!faults.empty() && fault.cycle < faults.back().cycle) {
+	ok = false;
+      }
+      if (!ok) {
+	fprintf(stderr, "%s:%d: bad fault\n", filename, lineno);
+      }
+      faults.push_back(fault);
+    }
+    fclose(f);
+    return ok;
+  }
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+  }
+
+  uint8_t
+  shunt(uint64_t cycle) override
+  {
+    for (; next < faults.size() && faults[next].cycle <= cycle; next++) {
+      rig.run(faults[next].cycle);
+      rig.motor.locked = faults[next].stall;
+      rig.motor.short_r = faults[next].short_r;
+    }
+    rig.run(cycle);
+    double amps = rig.pin ? rig.motor.current : 0;
+    double counts = 256 * amps * ohms / rig.motor.p.supply;
+    return counts > 255 ? 255 : (uint8_t)counts;
+  }
+
+private:
+  sim::Rig& rig;
+  double ohms;
+  size_t next = 0;
+};
+
+// The fan, logging the cuts and restores.
+class Bench : public sim::Rig
+{
+public:
+  std::vector<std::pair<uint64_t, bool>> cuts;
+
+  void
+  cut(uint64_t cycle, bool off) override
+  {
+    Rig::cut(cycle, off);
+    printf("%9.4f s  %s\n", sim::seconds(cycle), off ? "cut" : "restore");
+    cuts.push_back({cycle, off});
+  }
+};
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+	  "usage: fault [-t seconds] [-k knob] [-s] [-r ohms] faults\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 10;
+  int knob = 128;
+  bool sw = false;
+  double ohms = 1;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:sr:")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    case 's':
+      sw = true;
+      break;
+    case 'r':
+      ohms = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1 || knob < 0 || knob > 255 || ohms <= 0) {
+    usage();
+  }
+
+  Bench bench;
+  Faults faults(bench, ohms);
+  if (!faults.load(argv[optind])) {
+    return 1;
+  }
+
+  sim::Sim hw(sim::cycles(seconds));
+  hw.knob = knob;
+  hw.sw = sw;
+  hw.sense = true;
+  hw.input = &faults;
+  hw.output = &bench;
+  try {
+    spiro::Spiro<sim::Sim>(hw).run();
+  }
+  catch (sim::Sim::Done&) {
+  }
+
+  printf("\n%9s  %-10s %10s\n", "at", "fault", "latency");
+  for (size_t i = 0; i < faults.faults.size(); i++) {
+    const Fault& f = faults.faults[i];
+    if (!f.stall && !f.short_r) {
+      continue;
+    }
+    uint64_t until = i + 1 < faults.faults.size()
+      ? faults.faults[i + 1].cycle : hw.cycle;
+    char what[32];
+    if (f.stall) {
+      snprintf(what, sizeof what, "stall");
+    }
+    else {
+      snprintf(what, sizeof what, "short %g", f.short_r);
+    }
+    printf("%9.4f  %-10s", sim::seconds(f.cycle), what);
+    bool off = false;
+    bool found = false;
+    for (auto& cut : bench.cuts) {
+      if (cut.first < f.cycle) {
+	off = cut.second;
+      }
+      else if (off) {
+	printf(" %11s\n", "already cut");
+	found = true;
+	break;
+      }
+      else if (cut.second && cut.first < until) {
+	printf(" %8.3f ms\n", 1000 * sim::seconds(cut.first - f.cycle));
+	found = true;
+	break;
+      }
+    }
+    if (!found) {
+      printf(" %11s\n", off ? "already cut" : "undetected");
+    }
+  }
+
+  return 0;
+}
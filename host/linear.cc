@@ -0,0 +1,188 @@
+// A LINEAR=1 build's duty table, calibrated against the fan model,
+// and how evenly it spreads the fan's speed compared to scale_pwm().
+//
+//   linear [-t seconds] [-m pwm_min] [-p pulses] [-k step]
+//
+// Runs the firmware's calibration on a blank table with the fan's
+// tach giving -p pulses a revolution (default 2), for up to -t
+// seconds (default 240, which is long enough with the default
+// tuning), and prints how long it took and the table.  Then for every
+// -k'th knob position (default 16) the duty and settled speed each
+// way, and for each way:
+//
+//   error     the worst speed's distance from the straight line from
+//             the knob at 0 to full speed, as a percentage of full
+//   steps     the smallest and largest speed change over one knob
+//             step of -k
+//   quarters  the share of random ramp targets in each quarter of
+//             that speed range, which scale(rnd >> 8) draws evenly
+//             from the knob positions
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "motor.h"
+
+// The tach from the fan model's angle.
+class Tach : public sim::Input
+{
+public:
+  Tach(sim::Rig& rig, int pulses)
+    : rig(rig), pulses(pulses)
+  {
+  }
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+  }
+
+  uint64_t last = 0;		// The end of the last count.
+
+  uint16_t
+  tach(uint64_t from, uint64_t to) override
+  {
+    last = to;
+    rig.run(from);
+    double a0 = edges(rig.motor.angle);
+    rig.run(to);
+    return (uint16_t)(edges(rig.motor.angle) - a0);
+  }
+
+private:
+  sim::Rig& rig;
+  int pulses;
+
+  // Two edges a pulse.
+  double
+  edges(double angle) const
+  {
+    return floor(angle / (2 * M_PI) * 2 * pulses);
+  }
+};
+
+struct Way
+{
+  const char* name;
+  std::vector<double> speed;	// rpm for each knob position.
+};
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: linear [-t seconds] [-m pwm_min] [-p pulses] "
+	  "[-k step]\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 240;
+  int pwm_min = spiro::DefaultTuning::pwm_min;
+  int pulses = 2;
+  int step = 16;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:m:p:k:")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'm':
+      pwm_min = atoi(optarg);
+      break;
+    case 'p':
+      pulses = atoi(optarg);
+      break;
+    case 'k':
+      step = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || pwm_min < 0 || pwm_min > 255 || pulses < 1
+      || step < 1 || step > 255) {
+    usage();
+  }
+
+  sim::Rig rig;
+  Tach tach(rig, pulses);
+  sim::Tuning tuning;
+  tuning.pwm_min = pwm_min;
+  sim::Sim hw(sim::cycles(seconds));
+  hw.linear = true;
+  hw.input = &tach;
+  hw.output = &rig;
+  try {
+    spiro::Spiro<sim::Sim, sim::Tuning>(hw, tuning).run();
+  }
+  catch (sim::Sim::Done&) {
+  }
+  if (hw.duty_writes < spiro::duty_entries) {
+    fprintf(stderr, "linear: calibration unfinished after %.0f s, "
+	    "%llu entries\n", seconds, (unsigned long long)hw.duty_writes);
+    return 1;
+  }
+
+  printf("calibrated in %.1f s\n\nduty table", sim::seconds(tach.last));
+  for (uint8_t k = 0; k < spiro::duty_entries; k++) {
+    printf(k % 16 ? " %3u" : "\n  %3u", hw.eeprom[k]);
+  }
+  printf("\n\n");
+
+  // The steady speeds, on a fresh fan.
+  sim::Rig fan;
+  Way ways[2] = { { "scale_pwm" }, { "linear" } };
+  for (int in = 0; in < 256; in++) {
+    uint8_t k = in >> 2;
+    uint8_t d[2] = {
+      spiro::scale_pwm(in, pwm_min),
+      spiro::linear_pwm(in, hw.eeprom[k],
+			k + 1 < spiro::duty_entries ? hw.eeprom[k + 1] : 0xFF),
+    };
+    for (int w = 0; w < 2; w++) {
+      ways[w].speed.push_back(sim::rpm(fan.target(d[w])));
+    }
+    if (in % step == 0 || in == 255) {
+      printf("knob %3d   %3u %6.0f rpm   %3u %6.0f rpm\n", in,
+	     d[0], ways[0].speed.back(), d[1], ways[1].speed.back());
+    }
+  }
+
+  printf("\n%-10s %8s %17s  %s\n", "", "error", "steps rpm", "quarters");
+  for (auto& w : ways) {
+    double lo = w.speed[0];
+    double full = sim::rpm(fan.target(0xFF));
+    double error = 0;
+    for (int in = 0; in < 256; in++) {
+      double line = lo + (full - lo) * in / 256;
+      error = std::max(error, fabs(w.speed[in] - line));
+    }
+    double smallest = full;
+    double largest = 0;
+    for (int in = step; in < 256; in += step) {
+      double s = w.speed[in] - w.speed[in - step];
+      smallest = std::min(smallest, s);
+      largest = std::max(largest, s);
+    }
+    int quarters[4] = {};
+    for (int in = 0; in < 256; in++) {
+      int q = (int)(4 * (w.speed[in] - lo) / (full - lo));
+      quarters[q < 0 ? 0 : q > 3 ? 3 : q]++;
+    }
+    printf("%-10s %7.1f%% %8.0f %8.0f ", w.name, 100 * error / full,
+	   smallest, largest);
+    for (int q : quarters) {
+      printf(" %3.0f%%", 100.0 * q / 256);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -0,0 +1,185 @@
+#ifndef LST_H
+#define LST_H
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+
+// Reads the firmware's avr-objdump -S listing, for the static
+// analyzers.
+
+namespace sim {
+
+inline std::string
+trim(const std::string& s)
+{
+  size_t a = s.find_first_not_of(" \t");
+  size_t b = s.find_last_not_of(" \t\r\n");
+  return a == std::string::npos ? "" : s.substr(a, b - a + 1);
+}
+
+struct Insn
+{
+  uint32_t addr;
+  uint32_t size;		// Bytes.
+  std::string op;
+  std::string args;
+  long target = -1;		// Branch, jump or call target.
+  std::string text;		// Source and symbols shown before it.
+};
+
+// How control leaves an instruction.
+enum Flow
+{
+  flow_next,			// To the next instruction.
+  flow_jump,			// To target.
+  flow_branch,			// To the next or target.
+  flow_skip,			// To the next or the one after.
+  flow_call,			// Calls target, then the next.
+  flow_return,			// ret or reti.
+  flow_indirect,		// ijmp or icall, which we can't follow.
+};
+
+// avr-gcc makes room for a small frame with "rcall .+0", which only
+// pushes the return address: 3 cycles and 2 bytes, not a call.
+inline bool
+pushes_pc(const Insn& insn)
+{
+  return insn.op == "rcall" && insn.target == (long)(insn.addr + insn.size);
+}
+
+inline Flow
+flow(const Insn& insn)
+{
+  const std::string& op = insn.op;
+  if (op == "ret" || op == "reti") {
+    return flow_return;
+  }
+  if (op == "rjmp" || op == "jmp") {
+    return flow_jump;
+  }
+  if (op == "rcall" || op == "call") {
+    return pushes_pc(insn) ? flow_next : flow_call;
+  }
+  if (op.size() == 4 && op.compare(0, 2, "br") == 0 && op != "break") {
+    return flow_branch;
+  }
+  if (op == "cpse" || op == "sbrc" || op == "sbrs" || op == "sbic"
+      || op == "sbis") {
+    return flow_skip;
+  }
+  if (op == "ijmp" || op == "icall" || op == "eijmp" || op == "eicall") {
+    return flow_indirect;
+  }
+  return flow_next;
+}
+
+struct Listing
+{
+  std::map<uint32_t, Insn> code;
+  std::map<std::string, uint32_t> symbols;
+  std::map<uint32_t, std::string> names;
+
+  // Reads avr-objdump -d or -S output.  Lines that are neither
+  // instructions nor symbols are source, which objdump only shows when
+  // it changes, so each instruction gets the last shown.
+  bool
+  read(const char* filename)
+  {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+      perror(filename);
+      return false;
+    }
+    char line[1024];
+    std::string text, last;
+    bool in_text = false;
+    while (fgets(line, sizeof line, f)) {
+      unsigned addr;
+      int n;
+      if (strncmp(line, "Disassembly of section ", 23) == 0) {
+	in_text = strncmp(line + 23, ".text", 5) == 0;
+	text.clear();
+	last.clear();
+	continue;
+      }
+      if (!in_text) {
+	continue;
+      }
+      // "00000068 <foo>:", where foo may be a demangled template.
+      std::string l = trim(line);
+      size_t lt = l.find(" <");
+      if (isxdigit(line[0]) && lt != std::string::npos
+	  && l.size() > lt + 4 && l.compare(l.size() - 2, 2, ">:") == 0) {
+	std::string name = l.substr(lt + 2, l.size() - lt - 4);
+	addr = strtoul(l.c_str(), nullptr, 16);
+	symbols[name] = addr;
+	names[addr] = name;
+	text += "<" + name + ">\n";
+	continue;
+      }
+
+      // "  2e:\t0e 94 34 00 \tcall\t0x68\t; 0x68 <foo>"
+      char* tab1 = strchr(line, '\t');
+      if (sscanf(line, " %x:%n", &addr, &n) == 1 && tab1
+	  && tab1 == line + n) {
+	char* tab2 = strchr(tab1 + 1, '\t');
+	if (!tab2) {
+	  continue;		// Data, or a truncated line.
+	}
+	Insn insn;
+	insn.addr = addr;
+	insn.size = 0;
+	for (char* p = tab1 + 1; p < tab2; p++) {
+	  if (isxdigit(p[0]) && isxdigit(p[1])) {
+	    insn.size++;
+	    p++;
+	  }
+	}
+	std::string rest = trim(tab2 + 1);
+	std::string comment;
+	size_t semi = rest.find(';');
+	if (semi != std::string::npos) {
+	  comment = rest.substr(semi + 1);
+	  rest = trim(rest.substr(0, semi));
+	}
+	size_t sp = rest.find_first_of(" \t");
+	insn.op = rest.substr(0, sp);
+	insn.args = sp == std::string::npos ? "" : trim(rest.substr(sp));
+	unsigned t;
+	if (sscanf(comment.c_str(), " 0x%x", &t) == 1) {
+	  insn.target = t;
+	}
+	else if (insn.args.compare(0, 1, ".") == 0) {
+	  insn.target = addr + 2 + atol(insn.args.c_str() + 1);
+	}
+	if (!text.empty()) {
+	  last = text;
+	  text.clear();
+	}
+	insn.text = last;
+	code[addr] = insn;
+	continue;
+      }
+      text += line;
+    }
+    fclose(f);
+    return true;
+  }
+
+  // The address after insn's skip: past the next instruction.
+  uint32_t
+  skip(const Insn& insn)
+  {
+    uint32_t next = insn.addr + insn.size;
+    auto n = code.find(next);
+    return next + (n == code.end() ? 2 : n->second.size);
+  }
+};
+
+} // namespace sim
+
+#endif // LST_H
@@ -0,0 +1,345 @@
+#ifndef MOTOR_H
+#define MOTOR_H
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#include "sim.h"
+
+// A brushed DC model of the motor and fan, switched on the low side
+// by the PWM pin with a freewheel diode across the motor.  While the
+// switch is on the winding sees the supply less the back-EMF; while
+// it's off the current decays through the diode and can't reverse.
+// So at low PWM frequencies, where the L/R time constant is short
+// compared to the period, the current is discontinuous and the speed
+// for a given duty differs from the continuous high-frequency case.
+//
+// The mechanical side is inertia against running friction plus fan
+// drag proportional to speed squared.  From rest the motor only
+// starts once the torque exceeds the breakaway friction.
+
+namespace sim {
+
+struct MotorParams
+{
+  double supply = 3.3;		// V
+  double r = 8;			// Ohm
+  double l = 0.5e-3;		// H
+  double k = 0.004;		// V/(rad/s), which is also Nm/A
+  double j = 2e-6;		// kg m^2
+  double friction = 5e-5;	// Nm
+  double breakaway = 1e-4;	// Nm
+  double drag = 2e-9;		// Nm/(rad/s)^2
+  double diode = 0.4;		// V
+};
+
+inline double
+rpm(double omega)
+{
+  return omega * 60 / (2 * M_PI);
+}
+
+class Motor
+{
+public:
+  Motor(const MotorParams& p, double dt)
+    : p(p), dt(dt), decay(exp(-dt * p.r / p.l))
+  {
+  }
+
+  const MotorParams p;
+  const double dt;
+  double omega = 0;		// rad/s
+  double current = 0;		// A, through the winding
+  double angle = 0;		// rad, turned so far
+
+  // Faults, for testing a SENSE build's protection: the rotor held
+  // still, and the winding shorted down to short_r ohms, or 0 for no
+  // short.
+  bool locked = false;
+  double short_r = 0;
+
+  // Advance dt with the switch on or off.  Returns the mean current
+  // drawn from the supply over the step.
+  double
+  step(bool on)
+  {
+    double r = p.r;
+    double d = decay;
+    if (short_r) {
+      r = short_r;
+      d = exp(-dt * r / p.l);
+    }
+    double i0 = current;
+    if (on) {
+      double a = (p.supply - p.k * omega) / r;
+      current = a + (current - a) * d;
+    }
+    else if (current > 0) {
+      double b = -(p.diode + p.k * omega) / r;
+      current = b + (current - b) * d;
+      if (current < 0) {
+	current = 0;
+      }
+    }
+    double i = (i0 + current) / 2;
+
+    double torque = p.k * i;
+    if (locked) {
+      omega = 0;
+    }
+    else if (omega > 0 || torque > p.breakaway) {
+      omega += (torque - p.friction - p.drag * omega * omega) / p.j * dt;
+      if (omega < 0) {
+	omega = 0;
+      }
+    }
+    angle += omega * dt;
+
+    return on ? i : 0;
+  }
+
+  // The running speed the motor settles to when switched on for
+  // on_ticks out of every period_ticks steps, or 0 if it can't keep
+  // turning.  Found by bisection on the mean torque with the current
+  // iterated to its periodic steady state at each trial speed.
+  double
+  steady(uint32_t on_ticks, uint32_t period_ticks) const
+  {
+    double lo = 0;
+    double hi = p.supply / p.k;
+    if (net_torque(lo, on_ticks, period_ticks) <= 0) {
+      return 0;
+    }
+    for (int n = 0; n < 40; n++) {
+      double mid = (lo + hi) / 2;
+      if (net_torque(mid, on_ticks, period_ticks) > 0) {
+	lo = mid;
+      }
+      else {
+	hi = mid;
+      }
+    }
+    return lo;
+  }
+
+private:
+  const double decay;
+
+  double
+  net_torque(double w, uint32_t on_ticks, uint32_t period_ticks) const
+  {
+    Motor m(p, dt);
+    double sum = 0;
+    // A few periods to settle the current, then measure the last.
+    for (int period = 0; period < 3; period++) {
+      sum = 0;
+      for (uint32_t t = 0; t < period_ticks; t++) {
+	m.omega = w;
+	double i0 = m.current;
+	m.step(t < on_ticks);
+	sum += (i0 + m.current) / 2;
+      }
+    }
+    return p.k * sum / period_ticks - p.friction - p.drag * w * w;
+  }
+};
+
+// The motor driven by Timer0, fed by the firmware's OCR0A writes, with
+// statistics on how well the fan follows them.
+//
+// Each change in the effective OCR0A starts a move towards the speed
+// that duty settles to.  A move is settled when the speed comes within
+// 2% of full speed of its target, or superseded if OCR0A changes
+// first, as it does on every step of a ramp.  Overshoot is how far
+// past the target the speed goes before the next move.  A stall is
+// the motor stopping.
+
+class Rig : public Output
+{
+public:
+  explicit
+  Rig(const MotorParams& p = MotorParams(), uint32_t prescale = pwm_prescale)
+    : motor(p, (double)prescale / cpu_hz), targets(256, -1)
+  {
+    timer.prescale = prescale;
+    tolerance = 0.02 * target(0xFF);
+  }
+
+  Motor motor;
+  Timer0 timer;
+  bool pin = false;		// PB0 during the last tick.
+  bool off = false;		// Cut by a SENSE build.
+
+  // Statistics.
+  uint64_t ticks = 0;
+  uint64_t moves = 0;
+  uint64_t settled = 0;
+  uint64_t superseded = 0;
+  double settle_total = 0;	// s
+  double settle_max = 0;	// s
+  double overshoot_max = 0;	// rad/s
+  double overshoot_max_pct = 0;
+  double error_total = 0;	// rad/s * ticks
+  uint64_t stalls = 0;
+  uint64_t stalled_ticks = 0;
+  double charge = 0;		// A * ticks
+  double peak = 0;		// A, the most over a tick
+  double peak_period = 0;	// A, the most over a PWM period
+
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    run(cycle);
+    timer.ocr_buffer = value;
+    driven = true;
+  }
+
+  // Advance the model up to cycle.
+  void
+  run(uint64_t cycle)
+  {
+    uint64_t end = cycle / timer.prescale;
+    while (ticks < end) {
+      uint8_t ocr = timer.ocr;
+      bool on = timer.tick(ticks) && driven && !off;
+      pin = on;
+      if (timer.ocr != ocr || ticks == 0) {
+	start_move();
+      }
+
+      bool running = motor.omega > 0;
+      double i = motor.step(on);
+      charge += i;
+      peak = std::max(peak, i);
+      period_charge += i;
+      if ((uint8_t)ticks == 0xFF) {
+	peak_period = std::max(peak_period, period_charge / 256);
+	period_charge = 0;
+      }
+      if (running && motor.omega == 0) {
+	stalls++;
+      }
+      if (motor.omega == 0) {
+	stalled_ticks++;
+      }
+      track();
+      ticks++;
+    }
+  }
+
+  void
+  cut(uint64_t cycle, bool off) override
+  {
+    run(cycle);
+    this->off = off;
+  }
+
+  double
+  seconds() const
+  {
+    return ticks * motor.dt;
+  }
+
+  void
+  print(FILE* out) const
+  {
+    double t = seconds();
+    fprintf(out, "simulated        %.3f s\n", t);
+    fprintf(out, "moves            %llu (%llu settled, %llu superseded)\n",
+	    (unsigned long long)moves, (unsigned long long)settled,
+	    (unsigned long long)superseded);
+    if (settled) {
+      fprintf(out, "time to target   mean %.1f ms, max %.1f ms\n",
+	      1000 * settle_total / settled, 1000 * settle_max);
+    }
+    fprintf(out, "overshoot        max %.0f rpm (%.1f%%)\n",
+	    rpm(overshoot_max), overshoot_max_pct);
+    if (ticks) {
+      fprintf(out, "tracking error   mean %.0f rpm\n",
+	      rpm(error_total / ticks));
+    }
+    fprintf(out, "stalls           %llu, stopped %.3f s\n",
+	    (unsigned long long)stalls, stalled_ticks * motor.dt);
+    if (ticks) {
+      double amps = charge / ticks;
+      fprintf(out, "motor power      %.1f mA, %.1f mW\n",
+	      1000 * amps, 1000 * amps * motor.p.supply);
+      fprintf(out, "peak current     %.0f mA, %.0f mA over a period\n",
+	      1000 * peak, 1000 * peak_period);
+    }
+  }
+
+  // The speed OCR0A = ocr settles to.
+  double
+  target(uint8_t ocr)
+  {
+    if (targets[ocr] < 0) {
+      targets[ocr] = motor.steady(ocr == 0xFF ? 256 : ocr + 1, 256);
+    }
+    return targets[ocr];
+  }
+
+private:
+  std::vector<double> targets;
+  double tolerance;
+  double period_charge = 0;	// A * ticks this PWM period
+
+  // OC0A isn't an output until init(), just before the first write.
+  bool driven = false;
+
+  // The current move.
+  bool active = false;
+  uint64_t move_start = 0;
+  double move_target = 0;
+  double move_size = 0;
+  int move_dir = 0;
+
+  void
+  start_move()
+  {
+    if (active) {
+      superseded++;
+    }
+    moves++;
+    active = true;
+    move_start = ticks;
+    move_target = target(timer.ocr);
+    move_size = fabs(move_target - motor.omega);
+    move_dir = move_target > motor.omega ? 1 : -1;
+  }
+
+  void
+  track()
+  {
+    double error = motor.omega - move_target;
+    error_total += fabs(error);
+
+    if (active && fabs(error) <= tolerance) {
+      active = false;
+      settled++;
+      double t = (ticks + 1 - move_start) * motor.dt;
+      settle_total += t;
+      if (t > settle_max) {
+	settle_max = t;
+      }
+    }
+
+    double over = move_dir * error;
+    if (over > overshoot_max) {
+      overshoot_max = over;
+    }
+    if (move_size > tolerance && over > 0) {
+      double pct = 100 * over / move_size;
+      if (pct > overshoot_max_pct) {
+	overshoot_max_pct = pct;
+      }
+    }
+  }
+};
+
+} // namespace sim
+
+#endif // MOTOR_H
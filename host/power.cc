@@ -0,0 +1,183 @@
+// Estimate supply current and energy for each operating mode.
+//
+//   power [-t seconds] [-k step] [-c mAh] [build]...
+//
+// Runs each build in manual mode at every step'th knob position and
+// in random ramp mode at every ramp rate, with the fan model as the
+// load, and prints the mean current split into CPU, peripherals, input
+// loads and motor, the power in mW (which is also mWh per hour), and
+// with -c the battery life.  In random mode builds that ramp a time
+// step per carry of the rate each tick also get the MCU's energy per
+// ramp, which is 256 carries, motor not included.  The builds are
+// listed in builds[] below; the default is all of them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "motor.h"
+#include "power.h"
+
+static void
+run_spiro(sim::DynClockSim& hw)
+{
+  spiro::Spiro<sim::Sim>(hw).run();
+}
+
+static void
+run_isr(sim::DynClockSim& hw)
+{
+  hw.c_isr();
+  spiro::Spiro<sim::IsrSim>(hw).run();
+}
+
+static void
+run_naked(sim::DynClockSim& hw)
+{
+  spiro::Spiro<sim::IsrSim>(hw).run();
+}
+
+static void
+run_sched(sim::DynClockSim& hw)
+{
+  spiro::Spiro<sim::SchedSim>(hw).run();
+}
+
+static void
+run_dynclock(sim::DynClockSim& hw)
+{
+  spiro::Spiro<sim::DynClockSim>(hw).run();
+}
+
+// Each build gets a DynClockSim, which behaves as a plain Sim, IsrSim
+// or SchedSim unless run as one.
+struct Build
+{
+  const char* name;
+  void (*run)(sim::DynClockSim&);
+  bool tick_ramps;
+};
+
+static const Build builds[] = {
+  { "spiro", run_spiro, false },
+  { "isr", run_isr, true },
+  { "naked", run_naked, true },
+  { "sched", run_sched, true },
+  { "dynclock", run_dynclock, true },
+};
+
+static sim::Estimate
+measure(const Build& build, bool sw, uint8_t knob, double seconds)
+{
+  sim::DynClockSim hw(sim::cycles(seconds));
+  hw.sw = sw;
+  hw.knob = knob;
+  sim::Rig rig;
+  hw.output = &rig;
+  try {
+    build.run(hw);
+  }
+  catch (sim::Sim::Done&) {
+  }
+  rig.run(hw.cycle);
+  return sim::estimate(hw.usage, rig.ticks ? rig.charge / rig.ticks : 0);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: power [-t seconds] [-k step] [-c mAh] [build]...\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 30;
+  int step = 32;
+  double capacity = 0;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:c:")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      step = atoi(optarg);
+      break;
+    case 'c':
+      capacity = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (step < 1 || step > 255) {
+    usage();
+  }
+
+  std::vector<const Build*> selected;
+  for (int i = optind; i < argc; i++) {
+    const Build* b = nullptr;
+    for (auto& build : builds) {
+      if (strcmp(build.name, argv[i]) == 0) {
+	b = &build;
+      }
+    }
+    if (!b) {
+      fprintf(stderr, "power: no build %s\n", argv[i]);
+      return 2;
+    }
+    selected.push_back(b);
+  }
+  if (selected.empty()) {
+    for (auto& build : builds) {
+      selected.push_back(&build);
+    }
+  }
+
+  sim::PowerParams p;
+  printf("%-10s %-6s %4s %7s %7s %7s %7s %7s %8s %8s %8s",
+	 "build", "mode", "knob", "active", "cpu_mA", "per_mA", "in_mA",
+	 "mot_mA", "total_mA", "mW", "uJ/ramp");
+  printf(capacity ? " %8s\n" : "\n", "hours");
+
+  for (const Build* b : selected) {
+    for (int sw = 0; sw <= 1; sw++) {
+      for (int knob = 0; ; knob += step) {
+	if (knob > 255) {
+	  knob = 255;
+	}
+	sim::Estimate e = measure(*b, sw, knob, seconds);
+	printf("%-10s %-6s %4d %6.1f%% %7.3f %7.3f %7.3f %7.2f %8.2f %8.2f",
+	       b->name, sw ? "random" : "manual", knob, 100 * e.active,
+	       e.cpu_ma, e.peripheral_ma, e.input_ma, e.motor_ma,
+	       e.total_ma(), e.total_ma() * p.volts);
+	if (sw && b->tick_ramps) {
+	  // A ramp's first step doesn't wait, and the next one starts a
+	  // tick after the last carry.
+	  double ticks = 256.0 * 256 / spiro::isr_ramp_rate(knob);
+	  double ramp = sim::seconds(ticks * sim::pwm_period);
+	  printf(" %8.1f", 1000 * e.mcu_ma() * p.volts * ramp);
+	}
+	else {
+	  printf(" %8s", "-");
+	}
+	if (capacity) {
+	  printf(" %8.1f", capacity / e.total_ma());
+	}
+	printf("\n");
+	if (knob == 255) {
+	  break;
+	}
+      }
+    }
+  }
+
+  return 0;
+}
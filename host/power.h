@@ -0,0 +1,82 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include "sim.h"
+
+// Supply current from where the simulated cycles went.  The ATtiny13
+// figures are read off the datasheet's typical characteristics at
+// 3.3V and 600kHz; the knob and switch are the external loads on the
+// inputs.  Treat the absolute numbers as estimates and the differences
+// between builds as the useful part.
+
+namespace sim {
+
+struct PowerParams
+{
+  double volts = 3.3;
+  double active_ma = 0.25;
+  double burst_ma = 1.6;	// Active at 4.8MHz.
+  double slow_ma = 0.06;	// Active at 75kHz.
+  double idle_ma = 0.07;
+  double slow_idle_ma = 0.025;	// Idle at 75kHz.
+  double power_down_ma = 0.0002;
+  double adc_ma = 0.2;
+  double timer0_ma = 0.005;
+  // PB3's pull-up draws current while the switch holds it low, which
+  // is all the time in manual mode.
+  double pullup_ohms = 35000;
+  // The knob pot sits across the supply.
+  double knob_ohms = 10000;
+};
+
+struct Estimate
+{
+  double cpu_ma = 0;
+  double peripheral_ma = 0;
+  double input_ma = 0;
+  double motor_ma = 0;
+  double active = 0;		// Fraction of time the CPU is active.
+
+  double
+  mcu_ma() const
+  {
+    return cpu_ma + peripheral_ma + input_ma;
+  }
+
+  double
+  total_ma() const
+  {
+    return mcu_ma() + motor_ma;
+  }
+};
+
+// motor_amps is the mean motor current over the same time, from the
+// fan model.
+inline Estimate
+estimate(const Usage& usage, double motor_amps,
+	 const PowerParams& p = PowerParams())
+{
+  Estimate e;
+  uint64_t total = 0;
+  for (uint64_t c : usage.cpu) {
+    total += c;
+  }
+  if (total == 0) {
+    return e;
+  }
+  double t = total;
+  e.active = (usage.cpu[active] + usage.cpu[burst] + usage.cpu[slow]) / t;
+  e.cpu_ma = (usage.cpu[active] * p.active_ma + usage.cpu[idle] * p.idle_ma
+	      + usage.cpu[power_down] * p.power_down_ma
+	      + usage.cpu[burst] * p.burst_ma + usage.cpu[slow] * p.slow_ma
+	      + usage.cpu[slow_idle] * p.slow_idle_ma) / t;
+  e.peripheral_ma = (usage.adc * p.adc_ma + usage.timer0 * p.timer0_ma) / t;
+  e.input_ma = 1000 * p.volts / p.knob_ohms
+    + usage.switch_low / t * 1000 * p.volts / p.pullup_ohms;
+  e.motor_ma = 1000 * motor_amps;
+  return e;
+}
+
+} // namespace sim
+
+#endif // POWER_H
@@ -0,0 +1,178 @@
+// Per-region time breakdown from the profiling marks in a VCD trace,
+// from simavr running a PROFILE build or from spirosim -v.
+//
+//   profile [-f] file.vcd
+//
+// The firmware puts the spiro::Mark region it's in on PB1, PB2 and
+// PB5.  Regions nest, and a change to a region already on the stack
+// is taken as a return to it, so the stack can be rebuilt from the
+// region number alone.  Prints each region's calls, self and total
+// time and time per call, then the stacks as an indented tree with
+// their share of the run.  With -f prints only the stacks in the
+// folded format flamegraph.pl reads, weighted in CPU cycles.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "vcdread.h"
+
+struct Region
+{
+  uint64_t calls = 0;
+  double self = 0;
+  double total = 0;
+  double longest = 0;
+};
+
+typedef std::vector<int> Stack;
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: profile [-f] file.vcd\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  bool folded = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "f")) != -1) {
+    switch (c) {
+    case 'f':
+      folded = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1) {
+    usage();
+  }
+  const char* filename = argv[optind];
+
+  std::vector<int> widths;
+  std::vector<sim::VcdChange> changes;
+  double end;
+  if (!sim::read_vcd(filename, {"PB1", "PB2", "PB5"}, widths, changes,
+		     end)) {
+    return 1;
+  }
+  for (size_t i = 0; i < widths.size(); i++) {
+    if (widths[i] != 1) {
+      fprintf(stderr, "%s: no marker pin %s\n", filename,
+	      i == 0 ? "PB1" : i == 1 ? "PB2" : "PB5");
+      return 1;
+    }
+  }
+
+  Region regions[spiro::nmarks];
+  std::map<Stack, double> stacks;
+  Stack stack{spiro::mark_main};
+  std::vector<double> entered{0};
+  uint8_t code = 0;
+  double t = 0;
+
+  // Charge the time up to now to the current stack.
+  auto charge = [&](double now) {
+    double dt = now - t;
+    regions[stack.back()].self += dt;
+    for (size_t i = 0; i < stack.size(); i++) {
+      // Only once per region if it's on the stack twice.
+      if (std::find(stack.begin(), stack.begin() + i, stack[i])
+	  == stack.begin() + i) {
+	regions[stack[i]].total += dt;
+      }
+    }
+    stacks[stack] += dt;
+    t = now;
+  };
+
+  // All the pins change on the same PORTB write, so take every change
+  // at a time stamp before looking at the region.
+  for (size_t i = 0; i < changes.size(); ) {
+    double now = changes[i].t;
+    uint8_t next = code;
+    for (; i < changes.size() && changes[i].t == now; i++) {
+      uint8_t bit = 1 << changes[i].signal;
+      next = changes[i].value == 1 ? next | bit : next & ~bit;
+    }
+    if (next == code) {
+      continue;
+    }
+    charge(now);
+    code = next;
+
+    auto on = std::find(stack.begin(), stack.end(), code);
+    if (on != stack.end()) {
+      while (stack.back() != code) {
+	Region& r = regions[stack.back()];
+	r.calls++;
+	r.longest = std::max(r.longest, now - entered.back());
+	stack.pop_back();
+	entered.pop_back();
+      }
+    }
+    else {
+      stack.push_back(code);
+      entered.push_back(now);
+    }
+  }
+  charge(std::max(end, t));
+
+  if (folded) {
+    for (auto& s : stacks) {
+      for (size_t i = 0; i < s.first.size(); i++) {
+	printf("%s%s", i ? ";" : "", sim::mark_names[s.first[i]]);
+      }
+      printf(" %llu\n", (unsigned long long)(s.second * sim::cpu_hz + 0.5));
+    }
+    return 0;
+  }
+
+  double run = t > 0 ? t : 1;
+  printf("%s: %.3f s\n", filename, t);
+  printf("%-6s %9s %10s %6s %10s %6s %9s %9s\n", "region", "calls",
+	 "self_ms", "self%", "total_ms", "total%", "mean_us", "max_us");
+  for (int m = 0; m < spiro::nmarks; m++) {
+    Region& r = regions[m];
+    if (!r.total) {
+      continue;
+    }
+    printf("%-6s %9llu %10.2f %5.1f%% %10.2f %5.1f%% %9.1f %9.1f\n",
+	   sim::mark_names[m], (unsigned long long)r.calls, 1000 * r.self,
+	   100 * r.self / run, 1000 * r.total, 100 * r.total / run,
+	   r.calls ? 1e6 * r.total / r.calls : 0, 1e6 * r.longest);
+  }
+
+  // The map's order puts each stack right before the ones it
+  // contains.
+  printf("\nstacks (total%%, self%%):\n");
+  std::map<Stack, double> totals;
+  for (auto& s : stacks) {
+    for (size_t n = 1; n <= s.first.size(); n++) {
+      totals[Stack(s.first.begin(), s.first.begin() + n)] += s.second;
+    }
+  }
+  for (auto& s : totals) {
+    double total = 100 * s.second / run;
+    auto self = stacks.find(s.first);
+    printf("  %*s%-*s %5.1f%% %5.1f%% %.*s\n",
+	   2 * (int)(s.first.size() - 1), "",
+	   14 - 2 * (int)(s.first.size() - 1), sim::mark_names[s.first.back()],
+	   total, self == stacks.end() ? 0 : 100 * self->second / run,
+	   (int)(total / 2 + 0.5),
+	   "##################################################");
+  }
+
+  return 0;
+}
@@ -0,0 +1,323 @@
+// Worst case RAM use: static data plus the deepest stack.
+//
+//   avr-size -A spiro.elf | ram [-s bytes] [-m bytes] spiro.lst spiro.su -
+//
+// The stack is main's deepest call chain, from the return address
+// crt1 pushes calling main, plus the deepest interrupt, which can
+// arrive at any time but doesn't nest.  Each call pushes a 2 byte
+// return address, as does taking an interrupt.  Frames come from
+// -fstack-usage output where it has the function, which avr-gcc counts
+// from before the return address, so they include it.  Otherwise they
+// come from the pushes in the listing, as for libgcc's assembler
+// routines, plus the return address.  An "rcall .+0" is a 2 byte push,
+// not a call.  The call graph comes from the listing.
+//
+// Prints the sections, each function's frame and deepest stack, and
+// the total against the RAM size (-s, default the ATtiny13's 64).
+// Exits 1 if fewer than -m bytes (default 8) would be left, or if the
+// stack can't be bounded: recursion, indirect calls or dynamic
+// frames.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "lst.h"
+
+struct Frame
+{
+  long bytes = 0;
+  bool dynamic = false;
+};
+
+struct Function
+{
+  bool done = false;
+  bool busy = false;
+  long frame = 0;
+  const char* from = "";
+  long depth = 0;		// Frame plus deepest call.
+  std::string deepest;		// Callee on the deepest path.
+};
+
+static sim::Listing listing;
+static std::map<std::string, Frame> frames;
+static std::map<uint32_t, Function> functions;
+static bool failed = false;
+
+// "void spiro::Spiro<Hw, Tuning>::run() [with Hw = Avr; ...]" from
+// -fstack-usage and "spiro::Spiro<Avr, spiro::DefaultTuning>::run()"
+// from the demangled listing are both spiro::Spiro::run.
+static std::string
+key(const std::string& name)
+{
+  std::string k;
+  int depth = 0;
+  for (char c : name) {
+    if (c == '(' && depth == 0) {
+      break;
+    }
+    if (c == '<') {
+      depth++;
+    }
+    else if (c == '>') {
+      depth--;
+    }
+    else if (depth == 0) {
+      if (c == ' ') {
+	k.clear();		// That was the return type.
+      }
+      else {
+	k += c;
+      }
+    }
+  }
+  return k;
+}
+
+// Reads -fstack-usage output: "file:line:col:name\tbytes\tqualifiers".
+static bool
+read_su(const char* filename)
+{
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  char line[1024];
+  while (fgets(line, sizeof line, f)) {
+    char* tab = strchr(line, '\t');
+    if (!tab) {
+      continue;
+    }
+    *tab = 0;
+    char* name = line;
+    for (int i = 0; i < 3 && name; i++) {
+      name = strchr(name, ':');
+      if (name) {
+	name++;
+      }
+    }
+    if (!name) {
+      continue;
+    }
+    char qualifiers[128] = "";
+    long bytes = 0;
+    sscanf(tab + 1, "%ld %127s", &bytes, qualifiers);
+    Frame& fr = frames[key(name)];
+    fr.bytes = std::max(fr.bytes, bytes);
+    fr.dynamic = fr.dynamic
+      || (strstr(qualifiers, "dynamic") && !strstr(qualifiers, "bounded"));
+  }
+  fclose(f);
+  return true;
+}
+
+// Reads avr-size -A output into section sizes.
+static bool
+read_size(const char* filename, std::map<std::string, long>& sections)
+{
+  FILE* f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  char line[256];
+  while (fgets(line, sizeof line, f)) {
+    char name[128];
+    long size;
+    if (sscanf(line, "%127s %ld", name, &size) == 2 && name[0] == '.') {
+      sections[name] = size;
+    }
+  }
+  if (f != stdin) {
+    fclose(f);
+  }
+  return true;
+}
+
+// The deepest stack from entry's return address down.
+static long
+depth(uint32_t entry)
+{
+  Function& fn = functions[entry];
+  std::string name = listing.names.count(entry) ? listing.names[entry] : "?";
+  if (fn.done) {
+    return fn.depth;
+  }
+  if (fn.busy) {
+    fprintf(stderr, "%s: recursion\n", name.c_str());
+    failed = true;
+    return 0;
+  }
+  fn.busy = true;
+
+  // Walk the function, counting pushes and following calls.
+  long pushes = 0;
+  long deepest = 0;
+  std::set<uint32_t> seen;
+  std::vector<uint32_t> work{entry};
+  while (!work.empty()) {
+    uint32_t a = work.back();
+    work.pop_back();
+    if (!seen.insert(a).second) {
+      continue;
+    }
+    auto i = listing.code.find(a);
+    if (i == listing.code.end()) {
+      fprintf(stderr, "%s: flows to %x, which isn't code\n", name.c_str(), a);
+      failed = true;
+      continue;
+    }
+    const sim::Insn& insn = i->second;
+    uint32_t next = a + insn.size;
+    if (insn.op == "push") {
+      pushes++;
+    }
+    else if (sim::pushes_pc(insn)) {
+      pushes += 2;
+    }
+    switch (sim::flow(insn)) {
+    case sim::flow_next:
+      work.push_back(next);
+      break;
+    case sim::flow_jump:
+      work.push_back(insn.target);
+      break;
+    case sim::flow_branch:
+      work.push_back(next);
+      work.push_back(insn.target);
+      break;
+    case sim::flow_skip:
+      work.push_back(next);
+      work.push_back(listing.skip(insn));
+      break;
+    case sim::flow_call: {
+      long d = depth(insn.target);
+      if (d > deepest) {
+	deepest = d;
+	fn.deepest = listing.names[insn.target];
+      }
+      work.push_back(next);
+      break;
+    }
+    case sim::flow_return:
+      break;
+    case sim::flow_indirect:
+      fprintf(stderr, "%s: %s at %x can't be followed\n", name.c_str(),
+	      insn.op.c_str(), a);
+      failed = true;
+      break;
+    }
+  }
+
+  auto fr = frames.find(key(name));
+  if (fr != frames.end()) {
+    fn.frame = fr->second.bytes;
+    fn.from = "su";
+    if (fr->second.dynamic) {
+      fprintf(stderr, "%s: dynamic stack frame\n", name.c_str());
+      failed = true;
+    }
+  }
+  else {
+    fn.frame = 2 + pushes;
+    fn.from = "pushes";
+  }
+  fn.depth = fn.frame + deepest;
+  fn.busy = false;
+  fn.done = true;
+  return fn.depth;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: ram [-s bytes] [-m bytes] spiro.lst spiro.su "
+	  "size.txt\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  long ram = 64;
+  long margin = 8;
+
+  int c;
+  while ((c = getopt(argc, argv, "s:m:")) != -1) {
+    switch (c) {
+    case 's':
+      ram = atol(optarg);
+      break;
+    case 'm':
+      margin = atol(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 3) {
+    usage();
+  }
+  const char* lst = argv[optind];
+  std::map<std::string, long> sections;
+  if (!listing.read(lst) || !read_su(argv[optind + 1])
+      || !read_size(argv[optind + 2], sections)) {
+    return 1;
+  }
+  if (!listing.symbols.count("main")) {
+    fprintf(stderr, "%s: no main\n", lst);
+    return 1;
+  }
+
+  long data = 0;
+  printf("%-24s %6s\n", "section", "bytes");
+  for (const char* s : {".data", ".bss", ".noinit"}) {
+    if (sections.count(s)) {
+      printf("%-24s %6ld\n", s, sections[s]);
+      data += sections[s];
+    }
+  }
+
+  long main_stack = depth(listing.symbols["main"]);
+  long isr_stack = 0;
+  std::string isr;
+  for (auto& s : listing.symbols) {
+    if (s.first.compare(0, 9, "__vector_") == 0
+	&& listing.code.count(s.second)) {
+      long d = depth(s.second);
+      if (d > isr_stack) {
+	isr_stack = d;
+	isr = s.first;
+      }
+    }
+  }
+
+  printf("\n%-24s %6s %-7s %6s  %s\n", "function", "frame", "from",
+	 "depth", "deepest call");
+  for (auto& f : functions) {
+    printf("%-24s %6ld %-7s %6ld  %s\n",
+	   listing.names[f.first].c_str(), f.second.frame, f.second.from,
+	   f.second.depth, f.second.deepest.c_str());
+  }
+
+  long total = data + main_stack + isr_stack;
+  printf("\nstatic %ld + main stack %ld + interrupt stack %ld%s%s%s"
+	 " = %ld of %ld bytes, %ld free\n",
+	 data, main_stack, isr_stack, isr.empty() ? "" : " (",
+	 isr.c_str(), isr.empty() ? "" : ")", total, ram, ram - total);
+  if (ram - total < margin) {
+    fprintf(stderr, "ram: %ld bytes free, less than the %ld required\n",
+	    ram - total, margin);
+    failed = true;
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+// A REMOTE=1 build taking commands from a simulated host.
+//
+//   remote [-t seconds] [-k knob] [-s] [-m] commands
+//
+// The commands file is as in serial.h.  -m models a SCHED=1 build.
+// Prints each command with, where it sets the output, the latency
+// from the firmware having its last data bit to the write of the new
+// value to OCR0A, and to the compare unit taking it at the next
+// BOTTOM, and the answers to queries: OCR0A, the knob and the mode
+// with the switch in bit 2.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "serial.h"
+
+class Log : public sim::Output
+{
+public:
+  struct Write
+  {
+    uint64_t cycle;
+    uint8_t value;
+  };
+
+  std::vector<Write> writes;
+  std::vector<std::pair<uint64_t, uint8_t>> answers;
+
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    writes.push_back(Write{cycle, value});
+  }
+
+  void
+  serial(uint64_t cycle, uint8_t b) override
+  {
+    answers.push_back({cycle, b});
+  }
+};
+
+// The first BOTTOM at or after cycle, on the model's grid.
+static uint64_t
+bottom(uint64_t cycle)
+{
+  return (cycle + sim::pwm_period - 1) / sim::pwm_period * sim::pwm_period;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: remote [-t seconds] [-k knob] [-s] [-m] "
+	  "commands\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 10;
+  int knob = 128;
+  bool sw = false;
+  bool sched = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:sm")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    case 's':
+      sw = true;
+      break;
+    case 'm':
+      sched = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1 || knob < 0 || knob > 255) {
+    usage();
+  }
+
+  sim::Host host;
+  if (!host.load(argv[optind])) {
+    return 1;
+  }
+  Log log;
+
+  // As in spirosim, one object runs as either build.
+  sim::SchedSim hw(sim::cycles(seconds));
+  hw.knob = knob;
+  hw.sw = sw;
+  hw.remote = true;
+  hw.input = &host;
+  hw.output = &log;
+  try {
+    if (sched) {
+      spiro::Spiro<sim::SchedSim>(hw).run();
+    }
+    else {
+      spiro::Spiro<sim::Sim>(hw).run();
+    }
+  }
+  catch (sim::Sim::Done&) {
+  }
+
+  printf("%9s  %-8s %10s %10s  %s\n", "at", "command", "write", "pin",
+	 "answer");
+  spiro::Remote remote = {};
+  size_t answer = 0;
+  for (size_t i = 0; i < host.commands.size(); i++) {
+    const sim::Host::Command& cmd = host.commands[i];
+    uint64_t at = host.received(i);
+    if (at >= hw.cycle) {
+      break;
+    }
+    char what[16];
+    if (cmd.op == 'q') {
+      snprintf(what, sizeof what, "q");
+    }
+    else {
+      snprintf(what, sizeof what, "%c %u", cmd.op, cmd.arg);
+    }
+    printf("%9.4f  %-8s", sim::seconds(cmd.cycle), what);
+
+    // Where the command takes the output to manual, the value it
+    // should get, which is unscaled with the default pwm_min of 0.
+    bool before = remote.switch_on(sw);
+    uint8_t was = remote.knob(knob);
+    if (cmd.op != 'q') {
+      remote.receive(cmd.op);
+      remote.receive(cmd.arg);
+    }
+    bool manual = !remote.switch_on(sw)
+      && (before || remote.knob(knob) != was);
+    uint64_t until = i + 1 < host.commands.size()
+      ? host.received(i + 1) : hw.cycle;
+    bool found = false;
+    if (manual) {
+      for (auto& w : log.writes) {
+	if (w.cycle >= at && w.cycle < until && w.value == remote.knob(knob)) {
+	  printf(" %7.3f ms %7.3f ms", 1000 * sim::seconds(w.cycle - at),
+		 1000 * sim::seconds(bottom(w.cycle) - at));
+	  found = true;
+	  break;
+	}
+      }
+    }
+    if (!found) {
+      printf(" %10s %10s", "-", "-");
+    }
+    if (cmd.op == 'q') {
+      printf(" ");
+      for (int n = 0; n < 3 && answer < log.answers.size(); n++) {
+	printf(" %u", log.answers[answer++].second);
+      }
+    }
+    printf("\n");
+  }
+
+  printf("\n%llu bytes received, %.2f%% of the CPU active\n",
+	 (unsigned long long)hw.rx_bytes,
+	 100.0 * hw.usage.cpu[sim::active] / hw.cycle);
+  return 0;
+}
@@ -0,0 +1,87 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "sim.h"
+
+// An input script: what the switch and knob do over time.  One line
+// per change,
+//
+//   # seconds switch knob
+//   0    0 128
+//   5.5  1 200
+//
+// Blank lines and text after '#' are ignored.  Times must not go
+// backwards.
+
+namespace sim {
+
+class Script : public Input
+{
+public:
+  struct Step
+  {
+    uint64_t cycle;
+    bool sw;
+    uint8_t knob;
+  };
+
+  std::vector<Step> steps;
+
+  // Returns false and prints a message if the file can't be read.
+  bool
+  load(const char* filename)
+  {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+      perror(filename);
+      return false;
+    }
+    char line[256];
+    int lineno = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof line, f)) {
+      lineno++;
+      char* hash = strchr(line, '#');
+      if (hash) {
+	*hash = '\0';
+      }
+      double t;
+      int sw, knob;
+      char extra;
+      int n = sscanf(line, "%lf %d %d %c", &t, &sw, &knob, &extra);
+      if (n == EOF) {
+	continue;
+      }
+      uint64_t cycle = cycles(t);
+      if (n != 3 || t < 0 || sw < 0 || sw > 1 || knob < 0 || knob > 255
+	  || (!steps.empty() && cycle < steps.back().cycle)) {
+	fprintf(stderr, "%s:%d: bad line\n", filename, lineno);
+	ok = false;
+      }
+      steps.push_back(Step{cycle, sw != 0, (uint8_t)knob});
+    }
+    fclose(f);
+    return ok;
+  }
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+    while (next < steps.size() && steps[next].cycle <= cycle) {
+      knob = steps[next].knob;
+      sw = steps[next].sw;
+      next++;
+    }
+  }
+
+private:
+  size_t next = 0;
+};
+
+} // namespace sim
+
+#endif // SCRIPT_H
@@ -0,0 +1,123 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "sim.h"
+
+// A host's spiro::Remote commands to a REMOTE build, from a file with
+// one per line:
+//
+//   # seconds command [argument]
+//   1    d 200		manual setting
+//   1    m 1		remote manual mode
+//   3    r 40		random ramp rate
+//   3    m 2		remote random mode
+//   5    q		query
+//   8    m 0		back to the switch and knob
+//
+// Blank lines and text after '#' are ignored.  A command's bytes go
+// back to back from its time, or once the one before and its answer
+// are done if that's later.  The knob and switch stay as they're set
+// on the Sim.
+
+namespace sim {
+
+class Host : public Input
+{
+public:
+  struct Command
+  {
+    uint64_t cycle;		// When its first start bit begins.
+    char op;
+    uint8_t arg;
+  };
+
+  std::vector<Command> commands;
+
+  // Returns false and prints a message if the file can't be read.
+  bool
+  load(const char* filename)
+  {
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+      perror(filename);
+      return false;
+    }
+    char line[256];
+    int lineno = 0;
+    bool ok = true;
+    uint64_t free = 0;		// When the line is next free.
+    while (ok && fgets(line, sizeof line, f)) {
+      lineno++;
+      char* hash = strchr(line, '#');
+      if (hash) {
+	*hash = '\0';
+      }
+      double t;
+      char op;
+      int arg = 0;
+      int n = sscanf(line, "%lf %c %d", &t, &op, &arg);
+      if (n == EOF) {
+	continue;
+      }
+      if (t < 0 || !strchr("drmq", op) || n != (op == 'q' ? 2 : 3)
+	  || arg < 0 || arg > 255) {
+	fprintf(stderr, "%s:%d: bad command\n", filename, lineno);
+	ok = false;
+      }
+      uint64_t cycle = cycles(t);
+      if (cycle < free) {
+	cycle = free;
+      }
+      commands.push_back(Command{cycle, op, (uint8_t)arg});
+      // 'q' is followed by its three byte answer, which starts half a
+      // bit after its stop bit.  Leave a bit after that.
+      free = cycle + (op == 'q' ? 42 : 20) * serial_bit;
+    }
+    fclose(f);
+    return ok;
+  }
+
+  // When the firmware has command i's last data bit, the earliest it
+  // can act on it.
+  uint64_t
+  received(size_t i) const
+  {
+    const Command& c = commands[i];
+    return c.cycle + (c.op == 'q' ? 0 : 10 * serial_bit)
+      + 17 * serial_bit / 2;
+  }
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+  }
+
+  uint64_t
+  serial(uint64_t cycle, uint8_t& b) override
+  {
+    for (; next < 2 * commands.size(); next++) {
+      const Command& c = commands[next / 2];
+      if (next % 2 && c.op == 'q') {
+	continue;
+      }
+      uint64_t start = c.cycle + next % 2 * 10 * serial_bit;
+      if (start >= cycle) {
+	b = next % 2 ? c.arg : c.op;
+	next++;
+	return start;
+      }
+    }
+    return UINT64_MAX;
+  }
+
+private:
+  size_t next = 0;		// Command * 2 + byte.
+};
+
+} // namespace sim
+
+#endif // SERIAL_H
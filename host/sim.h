@@ -0,0 +1,973 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#include "spiro.h"
+
+// A host implementation of the spiro::Spiro hardware policy.  Time is
+// counted in CPU cycles at the 600kHz the firmware runs at after it
+// sets CLKPR.  We don't execute AVR instructions, so each hardware
+// call is charged a cycle cost that also covers the arithmetic the
+// firmware does around it.  The figures in Costs are hand counts of
+// the instructions we expect avr-gcc to emit, not yet checked against
+// a listing or a run, so everything measured with them is an estimate.
+// spirosimavr -r measures isr_idle and isr_step on a real build, and
+// -b the main loop and a ramp step, to correct them from.
+//
+// The firmware never returns from run(), so the simulation ends by
+// throwing Sim::Done from whichever call crosses the end time.
+
+namespace sim {
+
+// The CPU clock: 9.6MHz / 16.
+const uint32_t cpu_hz = 600000;
+
+// What spiro.cc tells _delay_ms() the clock is.  It isn't, so the
+// delays run four times faster than their nominal length.
+const double f_cpu = 9.6e6 / 64;
+
+// Timer0 runs at CPU/8 with TOP = 0xFF.
+const uint32_t pwm_prescale = 8;
+const uint32_t pwm_period = 256 * pwm_prescale;
+
+// So does the ADC.  A conversion is 13 ADC clocks, the first after
+// enabling it 25.
+const uint32_t adc_prescale = 8;
+
+// A REMOTE build's serial line: 4800 baud, 125 cycles a bit, 10
+// bits a byte with the start and stop bits.
+const uint32_t baud = 4800;
+const uint32_t serial_bit = cpu_hz / baud;
+
+// A SUPPLY build's divider takes a quarter of VCC to ADC1, read
+// against 1.1V, and 3.3V reads supply_nominal.
+const uint8_t supply_nominal = 192;
+
+inline uint8_t
+supply_reading(double vcc)
+{
+  double v = vcc / 4 / 1.1 * 256 + 0.5;
+  return v > 255 ? 255 : (uint8_t)v;
+}
+
+inline double
+seconds(uint64_t cycles)
+{
+  return (double)cycles / cpu_hz;
+}
+
+inline uint64_t
+cycles(double seconds)
+{
+  return (uint64_t)(seconds * cpu_hz + 0.5);
+}
+
+struct Costs
+{
+  // Reset, avr-libc startup and the register setup in init(), and
+  // how far into that init() starts Timer0, normally and in a
+  // FAST_BOOT build.  The SUT fuses' reset delay isn't included.
+  uint32_t init = 40;
+  uint32_t init_timer0 = 30;
+  uint32_t init_timer0_fast = 14;
+  // A conversion is 13 ADC clocks, the first after enabling is 25,
+  // and the ADC clock is CPU/8.  Plus the call and polling.
+  uint32_t adc = 13 * 8 + 8;
+  uint32_t adc_first = 25 * 8 + 8;
+  // A ramp time step's arithmetic, Line::step() and the count of 256:
+  // mov, sub, cp, branch, add and dec, brne.
+  uint32_t step = 8;
+  // One trip around the main loop, mostly the division in scale_pwm.
+  uint32_t loop = 210;
+  uint32_t set_pwm = 2;
+  // The busy wait around each _delay_loop_1(), which is itself
+  // 3 cycles per count.
+  uint32_t delay = 5;
+  // The Timer0 overflow interrupt in isr_ramp builds, including the
+  // interrupt response and reti, when it has nothing to do and when it
+  // does a time step.  These are the naked version's; see IsrSim.
+  uint32_t isr_idle = 15;
+  uint32_t isr_step = 23;
+  // Once around the loop waiting for the interrupt to finish a ramp,
+  // not counting the ADC read.
+  uint32_t ramp_poll = 8;
+  // A mark() or unmark() in a PROFILE build.
+  uint32_t mark = 4;
+  // The division in scale_pwm(), which the main loop's figure above
+  // includes.  SchedSim charges it on its own.
+  uint32_t scale = 190;
+  // Counting down the task periods, per tick, a switch read and a
+  // telemetry copy.  SchedSim only.
+  uint32_t dispatch = 30;
+  uint32_t switch_read = 4;
+  uint32_t telemetry = 12;
+  // spiro::Knob's hysteresis on a knob reading.  SchedSim only.
+  uint32_t hysteresis = 10;
+  // A SENSE build's ADC interrupt, its read_adc(), which only fetches
+  // the interrupt's last knob reading, and once around init()'s wait
+  // for the first: lds, tst, breq.
+  uint32_t adc_isr = 40;
+  uint32_t adc_latest = 4;
+  uint32_t sense_wait = 5;
+  // A REMOTE build's pin change interrupt from reading a byte's last
+  // data bit to acting on it.  The rest is bit timing.
+  uint32_t serial_act = 20;
+  // A CLOCK=dynamic build changing the clock and prescalers.
+  uint32_t clock_switch = 14;
+  // A LINEAR build's table lookup, two EEPROM reads and the
+  // interpolation, which replaces scale above, and an EEPROM write,
+  // which the next one waits out.
+  uint32_t lookup = 24;
+  uint32_t eeprom_write = 2040;
+  // A SLEW build's step in the overflow interrupt, on top of the rest
+  // of it.
+  uint32_t slew = 20;
+  // A SUPPLY build's reading, three conversions against the knob's
+  // one and the division, and its scaling of a duty, the multiply, or
+  // the cached result when the duty hasn't changed.
+  uint32_t supply_read = 3 * 13 * 8 + 200;
+  uint32_t supply_scale = 50;
+  uint32_t supply_cached = 6;
+};
+
+// The spiro::Mark regions by name.
+const char* const mark_names[spiro::nmarks] = {
+  "main", "adc", "scale", "pwm", "step", "wait", "mode", "isr",
+};
+
+// The spiro::Task tasks by name, then SchedSim's slots for the
+// dispatch between them and the boot before.
+const char* const task_names[spiro::ntasks + 2] = {
+  "adc", "switch", "pwm", "telemetry", "dispatch", "boot",
+};
+
+// What the CPU is doing, for the power model.  burst is active at
+// the 4.8MHz of a CLOCK=dynamic build, and slow and slow_idle active
+// and idle at its 75kHz.
+enum Cpu { active, idle, power_down, burst, slow, slow_idle, ncpu };
+
+// A CLOCK=dynamic build's clocks, each clock_ratio times the last.
+enum Clock { clock_slow, clock_normal, clock_fast };
+const uint32_t clock_ratio = 8;
+
+// Where the cycles went, for the power model.
+struct Usage
+{
+  uint64_t cpu[ncpu] = {};
+  uint64_t adc = 0;		// ADC enabled
+  uint64_t timer0 = 0;		// Timer0 clocked
+  uint64_t switch_low = 0;	// PB3 held low against its pull-up
+};
+
+// The firmware's tuning as ordinary members, so a simulation can
+// vary them at run time.
+struct Tuning
+{
+  uint8_t pwm_min = spiro::DefaultTuning::pwm_min;
+  uint16_t kick_ms = spiro::DefaultTuning::kick_ms;
+  int16_t ramp_counter = spiro::DefaultTuning::ramp_counter;
+  int16_t ramp_bias = spiro::DefaultTuning::ramp_bias;
+  uint8_t ramp_delay = spiro::DefaultTuning::ramp_delay;
+  uint8_t lcg_shift = spiro::DefaultTuning::lcg_shift;
+  uint16_t lcg_inc = spiro::DefaultTuning::lcg_inc;
+  uint8_t calibrate_step = spiro::DefaultTuning::calibrate_step;
+  uint8_t tach_gate = spiro::DefaultTuning::tach_gate;
+  uint8_t settle_gates = spiro::DefaultTuning::settle_gates;
+  uint8_t knob_period = spiro::DefaultTuning::knob_period;
+};
+
+// Timer0 in fast PWM mode with OC0A non-inverting, as init() sets it
+// up.  The pin is set at BOTTOM and cleared on compare match, so it
+// is high for ocr + 1 of every 256 timer ticks, and always high when
+// ocr is 0xFF.  OCR0A is double buffered: a write only takes effect
+// at the next BOTTOM.
+
+struct Timer0
+{
+  uint32_t prescale = pwm_prescale;
+  uint8_t ocr = 0;		// What the compare unit is using.
+  uint8_t ocr_buffer = 0;	// What the firmware last wrote.
+
+  // The pin level during timer tick n, counting from when the timer
+  // was started.
+  bool
+  tick(uint64_t n)
+  {
+    uint8_t tcnt = (uint8_t)n;
+    if (tcnt == 0) {
+      ocr = ocr_buffer;
+    }
+    return tcnt <= ocr;
+  }
+};
+
+// Supplies the knob and switch as a function of time.
+class Input
+{
+public:
+  virtual ~Input() {}
+  virtual void at(uint64_t cycle, uint8_t& knob, bool& sw) = 0;
+  // The motor current shunt's ADC reading, for a SENSE build.
+  virtual uint8_t shunt(uint64_t cycle) { return 0; }
+  // The next byte a host sends a REMOTE build whose start bit begins
+  // at or after cycle.  Sets b and returns when, or UINT64_MAX if
+  // there are no more.
+  virtual uint64_t serial(uint64_t cycle, uint8_t& b) { return UINT64_MAX; }
+  // The fan's tach edges from one cycle to another, for a LINEAR
+  // build's calibration.
+  virtual uint16_t tach(uint64_t from, uint64_t to) { return 0; }
+};
+
+// Sees every write to OCR0A, the profiling marks, a SENSE build
+// cutting and restoring the PWM output, and a REMOTE build's answers.
+class Output
+{
+public:
+  virtual ~Output() {}
+  virtual void pwm(uint64_t cycle, uint8_t value) = 0;
+  virtual void mark(uint64_t cycle, uint8_t m) {}
+  virtual void cut(uint64_t cycle, bool off) {}
+  // b's start bit begins at cycle.
+  virtual void serial(uint64_t cycle, uint8_t b) {}
+};
+
+class Sim
+{
+public:
+  struct Done {};
+
+  static constexpr bool isr_ramp = false;
+  static constexpr bool fast_boot = false;
+  static constexpr bool sched = false;
+
+  explicit
+  Sim(uint64_t end)
+    : end(end)
+  {
+    for (uint8_t& e : eeprom) {
+      e = 0xFF;			// Blank.
+    }
+  }
+
+  // Current state.  knob and sw may be set directly when there is
+  // no Input.
+  uint64_t cycle = 0;
+  uint64_t end;
+  uint8_t knob = 0;
+  bool sw = false;
+  uint8_t ocr0a = 0;
+  bool adc_started = false;
+  bool adc_enabled = false;
+  bool timer0_enabled = false;
+  bool profile = false;		// Model a PROFILE build.
+  uint8_t region = spiro::mark_main;	// What mark() last set.
+  uint8_t running = spiro::ntasks + 1;	// What task() last set.
+  bool timer0_isr = false;	// Overflow interrupt enabled.
+  uint64_t overflow = 0;	// When Timer0 next overflows.
+  spiro::IsrRamp ramp = {};	// What the overflow interrupt works on.
+  bool hysteresis = false;	// Knob readings go through still.
+  spiro::Knob still = {};
+  // When init() started Timer0, and when it first reaches BOTTOM and
+  // sets the pin.  The rest of the model puts BOTTOM on a grid from
+  // cycle 0, which is near enough except when timing the boot.
+  uint64_t timer0_started = 0;
+  uint64_t timer0_bottom = 0;
+  bool ticked = false;		// Set by each overflow interrupt.
+  bool sense = false;		// Model a SENSE build.
+  uint64_t conversion = UINT64_MAX;	// When its ADC next finishes.
+  uint8_t sense_turn = 0;	// Knob on 0 mod 4, else shunt.
+  uint8_t sense_knob = 0;	// The last knob reading.
+  spiro::Guard guard = {};
+  uint64_t burst_cycles = 0;	// Left over from the last fast spend().
+  bool remote = false;		// Model a REMOTE build.
+  uint64_t rx = UINT64_MAX;	// When the host's next byte starts.
+  uint8_t rx_byte = 0;
+  spiro::Remote commands = {};
+  Clock clock = clock_normal;
+  bool linear = false;		// Model a LINEAR build.
+  uint8_t slew_rate = 0;	// Model a SLEW build at this rate.
+  spiro::Slew slew = {};
+  uint8_t eeprom[spiro::duty_entries];	// Its duty table.
+  bool supply = false;		// Model a SUPPLY build,
+  double vcc = 3.3;		// with this supply.
+  spiro::Supply trim = {128};
+  uint16_t supply_turn = 0;
+
+  Costs costs;
+  Input* input = nullptr;
+  Output* output = nullptr;
+
+  // Counters.
+  uint64_t adc_reads = 0;
+  uint64_t pwm_writes = 0;
+  uint64_t isr_runs = 0;
+  uint64_t cuts = 0;
+  uint64_t rx_bytes = 0;
+  uint64_t duty_writes = 0;
+  Usage usage;
+  // Cycles in each region, interrupts included in mark_isr.  Only
+  // tracked with profile set.
+  uint64_t region_cycles[spiro::nmarks] = {};
+  // Active cycles in each of task_names, interrupts not included.
+  // Only tracked by SchedSim.
+  uint64_t task_cycles[spiro::ntasks + 2] = {};
+
+  // The hardware policy.
+
+  void
+  init()
+  {
+    spend(costs.init_timer0);
+    timer0_started = cycle;
+    timer0_bottom = cycle + pwm_period;
+    spend(costs.init - costs.init_timer0);
+    adc_enabled = true;
+    timer0_enabled = true;
+    start_sense();
+    start_remote();
+    if (slew_rate) {
+      timer0_isr = true;
+      overflow = pwm_period;
+    }
+    wait_sense();
+  }
+
+  uint8_t
+  read_adc()
+  {
+    uint8_t v;
+    if (sense) {
+      spend(costs.adc_latest);
+      v = sense_knob;
+    }
+    else {
+      spend(adc_started ? costs.adc : costs.adc_first);
+      adc_started = true;
+      if (supply && (supply_turn++ & 1023) == 0) {
+	spend(costs.supply_read);
+	uint8_t was = trim.out;
+	trim.reading(supply_reading(vcc), supply_nominal);
+	if (hysteresis && trim.out != was) {
+	  set_pwm(trim.in);
+	}
+      }
+      sample();
+      v = knob;
+    }
+    if (hysteresis) {
+      spend(costs.hysteresis);
+      v = still.reading(v);
+    }
+    adc_reads++;
+    return remote ? commands.knob(v) : v;
+  }
+
+  // A SLEW build only sets the target, and the overflow interrupt
+  // writes OCR0A.
+  void
+  set_pwm(uint8_t pwm)
+  {
+    spend(costs.set_pwm);
+    if (supply) {
+      spend(pwm != trim.in ? costs.supply_scale : costs.supply_cached);
+      pwm = trim.scale(pwm);
+    }
+    if (slew_rate) {
+      slew.target = pwm;
+      return;
+    }
+    ocr0a = pwm;
+    pwm_writes++;
+    if (output) {
+      output->pwm(cycle, pwm);
+    }
+  }
+
+  void
+  kick()
+  {
+    spend(costs.set_pwm);
+    full_power();
+  }
+
+  bool
+  switch_on()
+  {
+    spend(linear ? costs.loop - costs.scale + costs.lookup : costs.loop);
+    sample();
+    return remote ? commands.switch_on(sw) : sw;
+  }
+
+  void
+  delay_loop_1(uint8_t count)
+  {
+    spend(costs.delay + 3 * (count ? count : 256));
+  }
+
+  void
+  delay_ms(double ms)
+  {
+    spend((uint64_t)(ms * f_cpu / 1000));
+  }
+
+  // Marks compile out unless profile is set, when they take their
+  // cycles and go to the output like the pins of a PROFILE build.
+  // The region times are only as good as Costs: scale_pwm()'s
+  // division is in costs.loop, so it shows up as main.
+
+  uint8_t
+  mark(uint8_t m)
+  {
+    uint8_t saved = region;
+    if (profile) {
+      spend(costs.mark);
+      set_region(m);
+    }
+    if (m == spiro::mark_step) {
+      spend(costs.step);
+    }
+    return saved;
+  }
+
+  // This runs in Marker's destructor, so mustn't throw Done, even
+  // while Done is unwinding the stack.
+  void
+  unmark(uint8_t saved)
+  {
+    if (profile) {
+      if (costs.mark < end - cycle) {
+	spend(costs.mark);
+      }
+      set_region(saved);
+    }
+  }
+
+  // The LINEAR calls.  Reading the table is in costs.lookup.
+
+  uint8_t
+  duty_table(uint8_t k)
+  {
+    return eeprom[k];
+  }
+
+  void
+  put_duty(uint8_t k, uint8_t d)
+  {
+    spend(costs.eeprom_write);
+    eeprom[k] = d;
+    duty_writes++;
+  }
+
+  // Counts until the overflow that ends the periods'th period from
+  // now, on the model's grid.
+  uint16_t
+  tach(uint8_t periods)
+  {
+    uint64_t from = cycle;
+    spend((cycle / pwm_period + periods) * pwm_period - cycle);
+    return input ? input->tach(from, cycle) : 0;
+  }
+
+  // The isr_ramp calls, for IsrSim.
+
+  void
+  start_ramp(const spiro::Line& line, uint8_t rate)
+  {
+    ramp.start(line, rate);
+  }
+
+  bool
+  ramping()
+  {
+    spend(costs.ramp_poll);
+    return ramp.busy();
+  }
+
+  void
+  set_ramp_rate(uint8_t rate)
+  {
+    ramp.rate = rate;
+  }
+
+  uint8_t
+  ramp_pwm()
+  {
+    return ramp.line.pwm;
+  }
+
+  // Advance time by n cycles with the CPU in the given state.  Any
+  // overflow interrupts in that time run first and stretch it.  At
+  // the other clocks active cycles, the interrupts' too, take
+  // clock_ratio times less or more time, which is what cycle counts
+  // everywhere else are.  Idle n is already time.
+  void
+  spend(uint64_t n, Cpu state = active)
+  {
+    Cpu busy = clock == clock_fast ? burst
+      : clock == clock_slow ? slow : active;
+    if (state == active) {
+      n = to_time(n);
+      state = busy;
+    }
+    else if (state == idle && clock == clock_slow) {
+      state = slow_idle;
+    }
+    uint64_t in_isr = 0;
+    for (uint64_t t = cycle + n; ; ) {
+      uint64_t next = timer0_isr ? overflow : end;
+      bool adc = sense && conversion < next;
+      if (adc) {
+	next = conversion;
+      }
+      bool serial = remote && rx < next;
+      if (serial) {
+	next = rx;
+      }
+      if (next > t || next >= end) {
+	break;
+      }
+      uint32_t c;
+      if (serial) {
+	c = serial_isr();
+      }
+      else if (adc) {
+	c = adc_isr();
+      }
+      else {
+	c = isr();
+	overflow += pwm_period;
+      }
+      c = to_time(c);
+      n += c;
+      t += c;
+      in_isr += c;
+    }
+
+    bool done = n >= end - cycle;
+    if (done) {
+      n = end - cycle;
+      in_isr = in_isr < n ? in_isr : n;
+    }
+    cycle += n;
+    usage.cpu[state] += n - in_isr;
+    usage.cpu[busy] += in_isr;
+    region_cycles[region] += n - in_isr;
+    region_cycles[spiro::mark_isr] += in_isr;
+    if (state == busy) {
+      task_cycles[running] += n - in_isr;
+    }
+    if (adc_enabled) {
+      usage.adc += n;
+    }
+    if (timer0_enabled) {
+      usage.timer0 += n;
+    }
+    if (!sw) {
+      usage.switch_low += n;
+    }
+    if (done) {
+      throw Done();
+    }
+  }
+
+protected:
+  uint64_t
+  to_time(uint64_t n)
+  {
+    if (clock == clock_fast) {
+      burst_cycles += n;
+      n = burst_cycles / clock_ratio;
+      burst_cycles %= clock_ratio;
+    }
+    else if (clock == clock_slow) {
+      n *= clock_ratio;
+    }
+    return n;
+  }
+
+  // The SENSE build's first conversion, the knob, starts in init(),
+  // which waits for it.
+  void
+  start_sense()
+  {
+    if (sense) {
+      conversion = cycle + 25 * adc_prescale;
+    }
+  }
+
+  void
+  wait_sense()
+  {
+    while (sense && sense_turn == 0) {
+      spend(costs.sense_wait);
+    }
+  }
+
+  // The kick: straight to OCR0A, past SUPPLY and SLEW.
+  void
+  full_power()
+  {
+    slew.target = 0xFF;
+    slew.pwm = 0xFF;
+    ocr0a = 0xFF;
+    pwm_writes++;
+    if (output) {
+      output->pwm(cycle, ocr0a);
+    }
+  }
+
+  void
+  start_remote()
+  {
+    if (remote && input) {
+      rx = input->serial(cycle, rx_byte);
+    }
+  }
+
+  void
+  sample()
+  {
+    if (input) {
+      input->at(cycle, knob, sw);
+    }
+  }
+
+  void
+  set_region(uint8_t m, uint64_t when)
+  {
+    if (m != region) {
+      region = m;
+      if (output) {
+	output->mark(when, m);
+      }
+    }
+  }
+
+  void
+  set_region(uint8_t m)
+  {
+    set_region(m, cycle);
+  }
+
+  // The Timer0 overflow interrupt.  Returns its cycles.
+  uint32_t
+  isr()
+  {
+    isr_runs++;
+    ticked = true;
+    uint8_t saved = region;
+    if (profile) {
+      set_region(spiro::mark_isr, overflow);
+    }
+    uint32_t c = costs.isr_idle;
+    if (ramp.tick()) {
+      c = costs.isr_step;
+      uint8_t pwm = ramp.line.pwm;
+      if (supply) {
+	c += costs.supply_scale;
+	pwm = trim.multiply(pwm);
+      }
+      if (slew_rate) {
+	slew.target = pwm;
+      }
+      else {
+	write_isr(c, pwm);
+      }
+    }
+    if (slew_rate) {
+      c += costs.slew;
+      if (slew.tick(slew_rate)) {
+	write_isr(c, slew.pwm);
+      }
+    }
+    if (profile) {
+      set_region(saved, overflow + c);
+    }
+    return c;
+  }
+
+  // The write lands after BOTTOM, so takes effect a period later.
+  void
+  write_isr(uint32_t c, uint8_t pwm)
+  {
+    ocr0a = pwm;
+    pwm_writes++;
+    if (output) {
+      output->pwm(overflow + c, ocr0a);
+    }
+  }
+
+  // A SENSE build's ADC interrupt, which starts the next conversion
+  // as it returns.  Returns its cycles.
+  uint32_t
+  adc_isr()
+  {
+    uint64_t at = conversion;
+    uint32_t c = costs.adc_isr;
+    if (sense_turn % 4 == 0) {
+      sample();
+      sense_knob = knob;
+    }
+    else {
+      uint8_t a = guard.reading(input ? input->shunt(at) : 0);
+      if (a == spiro::guard_cut) {
+	cuts++;
+      }
+      if (a == spiro::guard_restore && slew_rate) {
+	slew.pwm = 0;
+	ocr0a = 0;
+	if (output) {
+	  output->pwm(at + c, 0);
+	}
+      }
+      if (a != spiro::guard_none && output) {
+	output->cut(at + c, a == spiro::guard_cut);
+      }
+    }
+    sense_turn++;
+    conversion = at + c + 13 * adc_prescale;
+    return c;
+  }
+
+  // A REMOTE build's pin change interrupt, which takes the whole byte
+  // and, for 'q', the answer.  Returns its cycles.  The overflows and
+  // conversions it holds off run late, and only once however many
+  // there were, as their flags would.
+  uint32_t
+  serial_isr()
+  {
+    uint64_t at = rx;
+    uint8_t b = rx_byte;
+    rx_bytes++;
+    uint64_t done = at + 17 * serial_bit / 2 + costs.serial_act;
+    uint8_t c = commands.receive(b);
+    // A LINEAR build leaves it to the main loop.
+    if (c == 'd' && commands.mode == spiro::remote_manual && !linear) {
+      uint8_t duty = supply ? trim.multiply(commands.duty) : commands.duty;
+      if (slew_rate) {
+	slew.target = duty;
+      }
+      else {
+	ocr0a = duty;
+	pwm_writes++;
+	if (output) {
+	  output->pwm(done, ocr0a);
+	}
+      }
+    }
+    done += serial_bit;		// To the middle of the stop bit.
+    if (c == 'q') {
+      done += serial_bit;
+      uint8_t answer[3] = {
+	ocr0a, sense ? sense_knob : knob,
+	(uint8_t)(commands.mode | sw << 2),
+      };
+      for (uint8_t a : answer) {
+	if (output) {
+	  output->serial(done, a);
+	}
+	done += 10 * serial_bit;
+      }
+    }
+    rx = input->serial(done, rx_byte);
+    while (timer0_isr && overflow + pwm_period < done) {
+      overflow += pwm_period;
+    }
+    if (sense && conversion < done) {
+      conversion = done;
+    }
+    return done - at;
+  }
+};
+
+// Sim for firmware built with RAMP=isr or RAMP=naked, where the
+// overflow interrupt does the ramps.  Costs are the naked version's
+// unless c_isr() is called.
+
+class IsrSim : public Sim
+{
+public:
+  static constexpr bool isr_ramp = true;
+
+  explicit
+  IsrSim(uint64_t end)
+    : Sim(end)
+  {
+  }
+
+  // The C interrupt also pushes and pops the registers
+  // IsrRamp::tick() uses, which roughly doubles it.
+  void
+  c_isr()
+  {
+    costs.isr_idle = 34;
+    costs.isr_step = 56;
+  }
+
+  void
+  init()
+  {
+    Sim::init();
+    // Timer0 started in init(), which is near enough cycle 0 that
+    // the overflows are on the same grid as Timer0's.
+    timer0_isr = true;
+    overflow = pwm_period;
+  }
+};
+
+// Sim for firmware built with SCHED=1.  The overflow interrupt only
+// sets ticked, and costs.isr_idle is the C interrupt's for that.  As
+// with IsrSim, the object can be run as a plain Sim or IsrSim too.
+
+class SchedSim : public IsrSim
+{
+public:
+  static constexpr bool sched = true;
+
+  explicit
+  SchedSim(uint64_t end)
+    : IsrSim(end)
+  {
+  }
+
+  void
+  init()
+  {
+    IsrSim::init();
+    costs.isr_idle = 30;
+    hysteresis = true;
+  }
+
+  // Not the main loop's cost, which Sim puts here.
+  bool
+  switch_on()
+  {
+    spend(costs.switch_read);
+    sample();
+    return remote ? commands.switch_on(sw) : sw;
+  }
+
+  // Spiro marks every scale_pwm() and every sleep, so that's where
+  // the division and the dispatch after the sleep are charged, in
+  // scale and main.
+  uint8_t
+  mark(uint8_t m)
+  {
+    if (m == spiro::mark_wait) {
+      spend(costs.dispatch);
+    }
+    uint8_t saved = Sim::mark(m);
+    if (m == spiro::mark_scale) {
+      spend(linear ? costs.lookup : costs.scale);
+    }
+    return saved;
+  }
+
+  void
+  sleep_tick()
+  {
+    if (!ticked) {
+      spend(overflow - cycle, idle);
+    }
+    ticked = false;
+  }
+
+  void
+  telemetry(const spiro::Telemetry& t)
+  {
+    spend(costs.telemetry);
+    last_telemetry = t;
+    telemetry_reports++;
+  }
+
+  void
+  task(uint8_t t)
+  {
+    running = t;
+  }
+
+  spiro::Telemetry last_telemetry = {};
+  uint64_t telemetry_reports = 0;
+};
+
+// Sim for firmware built with SCHED=1 CLOCK=dynamic, which sleeps at
+// 75kHz and runs at 4.8MHz from waking, except for converting at
+// 600kHz.  Likewise it runs as a SchedSim too.
+
+class DynClockSim : public SchedSim
+{
+public:
+  explicit
+  DynClockSim(uint64_t end)
+    : SchedSim(end)
+  {
+  }
+
+  uint64_t clock_switches = 0;
+
+  uint8_t
+  read_adc()
+  {
+    Clock was = clock;
+    set_clock(clock_normal);
+    uint8_t v = Sim::read_adc();
+    set_clock(was);
+    return v;
+  }
+
+  void
+  sleep_tick()
+  {
+    set_clock(clock_slow);
+    SchedSim::sleep_tick();
+    set_clock(clock_fast);
+  }
+
+private:
+  void
+  set_clock(Clock c)
+  {
+    if (c != clock) {
+      spend(costs.clock_switch);
+      clock = c;
+      clock_switches++;
+    }
+  }
+};
+
+// Sim for firmware built with BOOT=fast, whose init() starts Timer0
+// first, a tick before BOTTOM with the kick already in OCR0A, and
+// leaves the first conversion running under the kick.
+
+class FastBootSim : public Sim
+{
+public:
+  static constexpr bool fast_boot = true;
+
+  explicit
+  FastBootSim(uint64_t end)
+    : Sim(end)
+  {
+  }
+
+  void
+  init()
+  {
+    spend(costs.init_timer0_fast);
+    full_power();
+    timer0_started = cycle;
+    timer0_bottom = cycle + pwm_prescale;
+    spend(costs.init - costs.init_timer0_fast);
+    adc_enabled = true;
+    adc_started = true;
+    timer0_enabled = true;
+    start_sense();
+    start_remote();
+    wait_sense();
+  }
+};
+
+} // namespace sim
+
+#endif // SIM_H
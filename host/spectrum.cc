@@ -0,0 +1,234 @@
+// The PWM pin's spectrum with and without SPREAD.
+//
+//   spectrum [-d pwm] [-t seconds] [-b Hz] [-f Hz] [-p pin] [file.vcd]
+//
+// Builds the pin's trace a timer tick at a time for a steady PWM value
+// (-d, default 128) from what the firmware sets up each period: TOP
+// fixed at 0xFF, or from spiro::Spread swept as SPREAD=triangle or
+// hopped as SPREAD=random, with the compare value from
+// spiro::spread_ocr().  A VCD file, such as spirosimavr -v writes of
+// a SPREAD build, adds its pin (default PB0; the motor is on PB1 in a
+// SPREAD build) as another column.
+//
+// Prints each trace's mean duty, which should be (pwm + 1) / 256,
+// then the power in each -b Hz band (default 20) up to -f Hz (default
+// 2000) in dB against the fixed trace's fundamental, and each trace's
+// loudest band and loudest single line, which is what's heard as the
+// tone.  The traces are -t seconds long (default 2), or the VCD
+// file's length, and the lines are 1 / that apart.  The fixed trace
+// is cut at a whole number of periods so its lines are exact.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "vcdread.h"
+
+// When the pin is high, in seconds.
+struct Pulse
+{
+  double rise, fall;
+};
+
+struct Trace
+{
+  std::string name;
+  std::vector<Pulse> pulses;
+  double length;		// s
+  std::vector<double> bands;	// Power in each band.
+  double loudest = 0;		// Power in the loudest line.
+};
+
+enum Mode { mode_fixed, mode_triangle, mode_random };
+
+static Trace
+synthesize(const char* name, Mode mode, uint8_t pwm, double seconds)
+{
+  Trace trace;
+  trace.name = name;
+  const double tick = (double)sim::pwm_prescale / sim::cpu_hz;
+  spiro::Spread spread = {};
+  double t = 0;
+  while (t < seconds) {
+    uint8_t top = mode == mode_triangle ? spread.triangle()
+      : mode == mode_random ? spread.random() : 0xFF;
+    uint8_t ocr = mode == mode_fixed ? pwm : spiro::spread_ocr(pwm, top);
+    trace.pulses.push_back(Pulse{t, t + (ocr + 1) * tick});
+    t += (top + 1) * tick;
+  }
+  trace.length = t;
+  return trace;
+}
+
+// Returns false if the file can't be read or has no pin signal.
+static bool
+read_trace(const char* filename, const char* pin, Trace& trace)
+{
+  std::vector<int> widths;
+  std::vector<sim::VcdChange> changes;
+  double end;
+  if (!sim::read_vcd(filename, {pin}, widths, changes, end)) {
+    return false;
+  }
+  if (widths[0] != 1) {
+    fprintf(stderr, "%s: no 1-bit signal %s\n", filename, pin);
+    return false;
+  }
+  trace.name = pin;
+  double rise = -1;
+  for (auto& c : changes) {
+    if (c.value == 1 && rise < 0) {
+      rise = c.t;
+    }
+    else if (c.value != 1 && rise >= 0) {
+      trace.pulses.push_back(Pulse{rise, c.t});
+      rise = -1;
+    }
+  }
+  if (rise >= 0) {
+    trace.pulses.push_back(Pulse{rise, end});
+  }
+  trace.length = end;
+  return true;
+}
+
+static double
+duty(const Trace& trace)
+{
+  double high = 0;
+  for (auto& p : trace.pulses) {
+    high += p.fall - p.rise;
+  }
+  return high / trace.length;
+}
+
+// The Fourier series of the trace over its length, a line every
+// 1 / length Hz, summed into bands.  Each pulse contributes
+// (e^-jwa - e^-jwb) / jw to a line, and a line's power is
+// 2 |X|^2 / length^2, which adds up to the variance.
+static void
+spectrum(Trace& trace, double band, double max_hz)
+{
+  size_t nbands = (size_t)(max_hz / band);
+  trace.bands.assign(nbands, 0);
+  double df = 1 / trace.length;
+  for (size_t m = 1; m * df < nbands * band; m++) {
+    double w = 2 * M_PI * m * df;
+    std::complex<double> x = 0;
+    for (auto& p : trace.pulses) {
+      x += std::polar(1.0, -w * p.rise) - std::polar(1.0, -w * p.fall);
+    }
+    x /= std::complex<double>(0, w);
+    double power = 2 * std::norm(x) / (trace.length * trace.length);
+    trace.bands[(size_t)(m * df / band)] += power;
+    trace.loudest = std::max(trace.loudest, power);
+  }
+}
+
+static double
+db(double power, double ref)
+{
+  return power > 0 ? 10 * log10(power / ref) : -999;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: spectrum [-d pwm] [-t seconds] [-b Hz] [-f Hz] "
+	  "[-p pin] [file.vcd]\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  int pwm = 128;
+  double seconds = 2;
+  double band = 20;
+  double max_hz = 2000;
+  const char* pin = "PB0";
+
+  int c;
+  while ((c = getopt(argc, argv, "d:t:b:f:p:")) != -1) {
+    switch (c) {
+    case 'd':
+      pwm = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'b':
+      band = atof(optarg);
+      break;
+    case 'f':
+      max_hz = atof(optarg);
+      break;
+    case 'p':
+      pin = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind > 1 || pwm < 0 || pwm > 255 || seconds <= 0
+      || band <= 0 || max_hz < band) {
+    usage();
+  }
+
+  std::vector<Trace> traces = {
+    synthesize("fixed", mode_fixed, pwm, seconds),
+    synthesize("triangle", mode_triangle, pwm, seconds),
+    synthesize("random", mode_random, pwm, seconds),
+  };
+  if (optind < argc) {
+    Trace vcd;
+    if (!read_trace(argv[optind], pin, vcd)) {
+      return 1;
+    }
+    traces.push_back(vcd);
+  }
+
+  printf("%-10s", "duty");
+  for (auto& t : traces) {
+    spectrum(t, band, max_hz);
+    printf(" %9.4f", duty(t));
+  }
+  printf("   want %.4f\n", (pwm + 1) / 256.0);
+
+  double ref = 0;
+  for (double p : traces[0].bands) {
+    ref = std::max(ref, p);
+  }
+  printf("\n%-10s", "Hz");
+  for (auto& t : traces) {
+    printf(" %9s", t.name.c_str());
+  }
+  printf("\n");
+  for (size_t i = 0; i < traces[0].bands.size(); i++) {
+    printf("%4.0f-%-5.0f", i * band, (i + 1) * band);
+    for (auto& t : traces) {
+      printf(" %9.1f", db(t.bands[i], ref));
+    }
+    printf("\n");
+  }
+  printf("\n%-10s", "band");
+  for (auto& t : traces) {
+    double peak = 0;
+    for (double p : t.bands) {
+      peak = std::max(peak, p);
+    }
+    printf(" %9.1f", db(peak, ref));
+  }
+  printf("\n%-10s", "line");
+  for (auto& t : traces) {
+    printf(" %9.1f", db(t.loudest, ref));
+  }
+  printf("\n");
+  return 0;
+}
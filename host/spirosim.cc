@@ -0,0 +1,178 @@
+// Run the firmware's control logic on the host.
+//
+//   spirosim [-t seconds] [-k knob] [-s] [-r busy|isr|naked] [-m]
+//            [-p] [-l] [-b] [-v vcd]
+//
+// Prints "cycle pwm" for every write to OCR0A.  With -b prints only
+// how fast the simulation ran.  With -v writes the PWM pin and OCR0A
+// to a VCD file instead.  -r picks the ramp like the Makefile's RAMP,
+// and -m runs the tick scheduler like SCHED=1.  -p simulates a
+// PROFILE build, whose marks go in the VCD file.  With -l prints only
+// the CPU load in each profiling region, or with -m in each task, the
+// dispatch between them, the boot and the interrupts.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+
+#include "spiro.h"
+#include "sim.h"
+#include "vcd.h"
+
+class Print : public sim::Output
+{
+public:
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    printf("%llu %u\n", (unsigned long long)cycle, value);
+  }
+};
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: spirosim [-t seconds] [-k knob] [-s] "
+	  "[-r busy|isr|naked] [-m] [-p] [-l] [-b] [-v vcd]\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 10;
+  int knob = 128;
+  bool sw = false;
+  bool bench = false;
+  const char* vcd = nullptr;
+  std::string ramp = "busy";
+  bool sched = false;
+  bool profile = false;
+  bool load = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:sr:mplbv:")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    case 's':
+      sw = true;
+      break;
+    case 'r':
+      ramp = optarg;
+      break;
+    case 'm':
+      sched = true;
+      break;
+    case 'p':
+      profile = true;
+      break;
+    case 'l':
+      profile = true;
+      load = true;
+      break;
+    case 'b':
+      bench = true;
+      break;
+    case 'v':
+      vcd = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || knob < 0 || knob > 255
+      || (ramp != "busy" && ramp != "isr" && ramp != "naked")) {
+    usage();
+  }
+
+  sim::SchedSim hw(sim::cycles(seconds));
+  if (ramp == "isr") {
+    hw.c_isr();
+  }
+  hw.knob = knob;
+  hw.sw = sw;
+  hw.profile = profile;
+
+  Print print;
+  FILE* vcd_file = nullptr;
+  sim::VcdWriter* vcd_writer = nullptr;
+  if (vcd) {
+    vcd_file = fopen(vcd, "w");
+    if (!vcd_file) {
+      perror(vcd);
+      return 1;
+    }
+    vcd_writer = new sim::VcdWriter(vcd_file);
+    hw.output = vcd_writer;
+  }
+  else if (!bench && !load) {
+    hw.output = &print;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  try {
+    if (sched) {
+      spiro::Spiro<sim::SchedSim>(hw).run();
+    }
+    else if (ramp == "busy") {
+      spiro::Spiro<sim::Sim>(hw).run();
+    }
+    else {
+      spiro::Spiro<sim::IsrSim>(hw).run();
+    }
+  }
+  catch (sim::Sim::Done&) {
+  }
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  if (vcd_writer) {
+    vcd_writer->run(hw.cycle);
+    if (fclose(vcd_file) != 0) {
+      perror(vcd);
+      return 1;
+    }
+  }
+
+  if (load && sched) {
+    printf("%-9s %12s %7s\n", "task", "cycles", "load");
+    for (int t = 0; t < spiro::ntasks + 2; t++) {
+      printf("%-9s %12llu %6.2f%%\n", sim::task_names[t],
+	     (unsigned long long)hw.task_cycles[t],
+	     100.0 * hw.task_cycles[t] / hw.cycle);
+    }
+    printf("%-9s %12llu %6.2f%%\n", "isr",
+	   (unsigned long long)hw.region_cycles[spiro::mark_isr],
+	   100.0 * hw.region_cycles[spiro::mark_isr] / hw.cycle);
+    printf("active %.2f%%\n", 100.0 * hw.usage.cpu[sim::active] / hw.cycle);
+  }
+  else if (load) {
+    printf("%-6s %12s %7s\n", "region", "cycles", "load");
+    for (int m = 0; m < spiro::nmarks; m++) {
+      if (hw.region_cycles[m]) {
+	printf("%-6s %12llu %6.2f%%\n", sim::mark_names[m],
+	       (unsigned long long)hw.region_cycles[m],
+	       100.0 * hw.region_cycles[m] / hw.cycle);
+      }
+    }
+    printf("active %.2f%%\n", 100.0 * hw.usage.cpu[sim::active] / hw.cycle);
+  }
+
+  if (bench) {
+    printf("simulated %.1fs in %.3fs (%.0fx real time), "
+	   "%llu adc reads, %llu pwm writes\n",
+	   sim::seconds(hw.cycle), elapsed.count(),
+	   sim::seconds(hw.cycle) / elapsed.count(),
+	   (unsigned long long)hw.adc_reads,
+	   (unsigned long long)hw.pwm_writes);
+  }
+
+  return 0;
+}
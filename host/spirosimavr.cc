@@ -0,0 +1,522 @@
+// Run a firmware build under simavr.
+//
+//   spirosimavr [-t seconds] [-k knob] [-s] [-i trace] [-v vcd] [-r]
+//               [-c commands] [-b] [-x] spiro.elf
+//
+// Prints "cycle pwm" for every OCR0A update, like spirosim and trace
+// play, so runs of two builds against the same trace can be diffed.
+// Inputs come from a trace (see trace.h), applied on exactly the
+// recorded cycles by simavr cycle timers, or are a fixed knob and
+// switch.  With -v also writes PB0 and OCR0A to a VCD file for
+// vcdpwm, and PB1, PB2 and PB5 for profile if it's a PROFILE build.
+// With -r also reports the cycles spent in the Timer0 overflow
+// interrupt of a RAMP=isr or RAMP=naked build, from its vector to
+// reti, to check Costs::isr_idle and isr_step.  With -c a
+// simulated host sends a REMOTE=1 build the commands in the file (see
+// serial.h) on PB1, and reports on stderr the answers it reads back
+// and how long after each 'd' argument's last data bit OCR0A got it.
+// With -b also reports how often an ADC conversion was started, for
+// make bench: with the switch off it's the main loop's rate, and with
+// it on in a RAMP=busy build, the length of a ramp's time step.
+//
+// Most of the firmware's cycles go round three loops: _delay_loop_1()'s
+// dec and brne, the sbiw and brne of _delay_ms() and
+// __builtin_avr_delay_cycles(), and the sbic or sbis and rjmp of
+// loop_until_bit_is_clear() and _set().  Those are skipped in whole
+// times round, setting the counter, flags and PC as running them would
+// have, up to the next simavr cycle timer or the end of the run,
+// whichever is first, and only while no interrupt is pending.  Every
+// other event is a cycle timer or comes from one, so the skipped
+// stretch can't have changed anything else and nothing happens late.
+// -b reports the share of the cycles skipped.  -x runs every
+// instruction instead, whose output should be the same.
+//
+// simavr doesn't model CLKPR, so cycles are counted at the 600kHz the
+// firmware selects and the few before that are counted the same.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_cycle_timers.h"
+#include "sim_interrupts.h"
+#include "avr_ioport.h"
+#include "avr_adc.h"
+#include "avr_timer.h"
+#include "sim_vcd_file.h"
+
+#include "sim.h"
+#include "trace.h"
+#include "serial.h"
+
+// The ADC reference is VCC.
+const uint32_t vcc_mv = 3300;
+
+// The TIM0_OVF vector's byte address, and reti.
+const avr_flashaddr_t tim0_ovf_vect = 0x0006;
+const uint16_t reti = 0x9518;
+
+// The idle loops' branches back, brne .-4 and rjmp .-4.
+const uint16_t brne_back = 0xF7F1;
+const uint16_t rjmp_back = 0xCFFE;
+
+struct Harness
+{
+  avr_t* avr;
+  avr_irq_t* sw;
+  avr_irq_t* knob;
+  sim::TraceReader* reader;
+  bool pending;
+  uint64_t cycle;
+  bool next_sw;
+  uint8_t next_knob;
+  // The simulated host on PB1.
+  avr_irq_t* line;
+  sim::Host* host;
+  uint64_t tx_start;		// The byte going out.
+  uint8_t tx;
+  int tx_bit;			// 0 is the start bit, 9 the stop bit.
+  uint8_t last_tx;
+  bool sending;
+  uint32_t level;		// PB1 as last seen.
+  bool receiving;
+  uint64_t rx_start;
+  uint8_t rx;
+  int rx_bit;
+  int expect;			// A 'd' argument, until OCR0A has it.
+  uint64_t expect_from;
+  // ADC conversions started, and the first and last one's cycle.
+  uint64_t conversions;
+  uint64_t first_conversion;
+  uint64_t last_conversion;
+};
+
+struct Skips
+{
+  uint64_t runs = 0;
+  uint64_t cycles = 0;
+};
+
+static uint16_t
+opcode(avr_t* avr, avr_flashaddr_t pc)
+{
+  return avr->flash[pc] | avr->flash[pc + 1] << 8;
+}
+
+// Skips as much of the idle loop at the PC as it can before limit
+// cycles have gone.  Returns the cycles skipped, 0 if it isn't at one
+// or there isn't a whole time round to skip.
+static uint64_t
+fast_forward(avr_t* avr, uint64_t limit)
+{
+  if (!limit || avr->state != cpu_Running
+      || (avr->sreg[S_I] && avr_has_pending_interrupts(avr))) {
+    return 0;
+  }
+  uint16_t op = opcode(avr, avr->pc);
+  uint16_t branch = opcode(avr, avr->pc + 2);
+
+  if ((op & 0xFE0F) == 0x940A && branch == brne_back) {
+    // dec rd, brne: 3 cycles round, 2 for the last.
+    uint8_t d = (op >> 4) & 0x1F;
+    uint32_t n = avr->data[d] ? avr->data[d] : 256;
+    uint64_t k = 3 * n - 1 < limit ? n : std::min<uint64_t>(n - 1,
+							     (limit - 1) / 3);
+    if (!k) {
+      return 0;
+    }
+    uint8_t r = n - k;
+    avr->data[d] = r;
+    avr->sreg[S_Z] = r == 0;
+    avr->sreg[S_N] = r >> 7;
+    avr->sreg[S_V] = r == 0x7F;
+    avr->sreg[S_S] = avr->sreg[S_N] ^ avr->sreg[S_V];
+    uint64_t c = k == n ? 3 * n - 1 : 3 * k;
+    if (k == n) {
+      avr->pc += 4;
+    }
+    avr->cycle += c;
+    return c;
+  }
+
+  if ((op & 0xFF00) == 0x9700 && (((op >> 2) & 0x30) | (op & 0xF)) == 1
+      && branch == brne_back) {
+    // sbiw rd, 1, brne: 4 cycles round, 3 for the last.
+    uint8_t d = 24 + 2 * ((op >> 4) & 3);
+    uint32_t v = avr->data[d] | avr->data[d + 1] << 8;
+    uint64_t n = v ? v : 65536;
+    uint64_t k = 4 * n - 1 < limit ? n : std::min<uint64_t>(n - 1,
+							     (limit - 1) / 4);
+    if (!k) {
+      return 0;
+    }
+    uint16_t r = n - k;
+    avr->data[d] = r;
+    avr->data[d + 1] = r >> 8;
+    avr->sreg[S_Z] = r == 0;
+    avr->sreg[S_N] = r >> 15;
+    avr->sreg[S_V] = r == 0x7FFF;
+    avr->sreg[S_S] = avr->sreg[S_N] ^ avr->sreg[S_V];
+    avr->sreg[S_C] = r == 0xFFFF;
+    uint64_t c = k == n ? 4 * n - 1 : 4 * k;
+    if (k == n) {
+      avr->pc += 4;
+    }
+    avr->cycle += c;
+    return c;
+  }
+
+  if ((op & 0xFD00) == 0x9900 && branch == rjmp_back) {
+    // sbic or sbis A, b, rjmp: 3 cycles round.  Only the event that
+    // ends it can end it, so it's never skipped out of.  Registers
+    // simavr works out on reading, like TCNT0, aren't polled this way
+    // by the firmware but are left alone anyway.
+    uint8_t a = (op >> 3) & 0x1F;
+    bool set = (avr->data[a + 0x20] >> (op & 7)) & 1;
+    bool sbis = op & 0x0200;
+    if (set == sbis || avr->io[a].r.c) {
+      return 0;
+    }
+    uint64_t k = (limit - 1) / 3;
+    avr->cycle += 3 * k;
+    return 3 * k;
+  }
+  return 0;
+}
+
+static void
+set_inputs(Harness* h, bool sw, uint8_t knob)
+{
+  avr_raise_irq(h->sw, sw);
+  // The middle of the 10-bit code whose top 8 bits are knob.
+  uint32_t code = (knob << 2) | 2;
+  avr_raise_irq(h->knob, code * vcc_mv / 1023);
+}
+
+static avr_cycle_count_t
+apply_trace(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+  Harness* h = (Harness*)param;
+  while (h->pending && h->cycle <= when) {
+    set_inputs(h, h->next_sw, h->next_knob);
+    h->pending = h->reader->read(h->cycle, h->next_sw, h->next_knob);
+  }
+  return h->pending ? h->cycle : 0;
+}
+
+static void
+print_pwm(avr_irq_t* irq, uint32_t value, void* param)
+{
+  Harness* h = (Harness*)param;
+  printf("%llu %u\n", (unsigned long long)h->avr->cycle, value);
+  if (h->expect >= 0 && value == (uint32_t)h->expect) {
+    fprintf(stderr, "%llu d %d: OCR0A after %.0fus\n",
+	    (unsigned long long)h->avr->cycle, h->expect,
+	    1e6 * sim::seconds(h->avr->cycle - h->expect_from));
+    h->expect = -1;
+  }
+}
+
+static void
+count_conversion(avr_irq_t* irq, uint32_t value, void* param)
+{
+  Harness* h = (Harness*)param;
+  if (!h->conversions++) {
+    h->first_conversion = h->avr->cycle;
+  }
+  h->last_conversion = h->avr->cycle;
+}
+
+// Drives the host's bytes onto PB1 a bit at a time, LSB first.
+static avr_cycle_count_t
+send_bit(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+  Harness* h = (Harness*)param;
+  if (h->tx_bit == 0) {
+    h->sending = true;
+    h->expect = -1;
+    if (h->last_tx == 'd') {
+      h->expect = h->tx;
+      h->expect_from = h->tx_start + 17 * sim::serial_bit / 2;
+    }
+  }
+  uint32_t v = h->tx_bit == 0 ? 0 : h->tx_bit == 9 ? 1
+    : (h->tx >> (h->tx_bit - 1)) & 1;
+  avr_raise_irq(h->line, v);
+  if (++h->tx_bit < 10) {
+    return h->tx_start + h->tx_bit * sim::serial_bit;
+  }
+  // Let go at the end of the stop bit.
+  h->last_tx = h->last_tx == 'd' || h->last_tx == 'r' || h->last_tx == 'm'
+    ? 0 : h->tx;
+  h->sending = false;
+  h->tx_bit = 0;
+  uint64_t next = h->host->serial(h->tx_start + 10 * sim::serial_bit, h->tx);
+  if (next == UINT64_MAX) {
+    return 0;
+  }
+  h->tx_start = next;
+  return next;
+}
+
+// Reads the firmware's answers in the middle of each bit.
+static avr_cycle_count_t
+read_bit(avr_t* avr, avr_cycle_count_t when, void* param)
+{
+  Harness* h = (Harness*)param;
+  h->rx = h->rx >> 1 | (h->level ? 0x80 : 0);
+  if (++h->rx_bit < 8) {
+    return h->rx_start + (3 + 2 * h->rx_bit) * sim::serial_bit / 2;
+  }
+  fprintf(stderr, "%llu answer %u\n", (unsigned long long)h->rx_start,
+	  h->rx);
+  h->receiving = false;
+  return 0;
+}
+
+static void
+line_changed(avr_irq_t* irq, uint32_t value, void* param)
+{
+  Harness* h = (Harness*)param;
+  h->level = value;
+  if (!value && !h->sending && !h->receiving) {
+    h->receiving = true;
+    h->rx_start = h->avr->cycle;
+    h->rx = 0;
+    h->rx_bit = 0;
+    avr_cycle_timer_register(h->avr, 3 * sim::serial_bit / 2, read_bit, h);
+  }
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: spirosimavr [-t seconds] [-k knob] [-s] "
+	  "[-i trace] [-v vcd] [-r] [-c commands] [-b] [-x] spiro.elf\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  double seconds = 10;
+  int knob = 128;
+  bool sw = false;
+  const char* trace = nullptr;
+  const char* vcd_file = nullptr;
+  bool isr = false;
+  const char* commands = nullptr;
+  bool bench = false;
+  bool exact = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:si:v:rc:bx")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    case 's':
+      sw = true;
+      break;
+    case 'i':
+      trace = optarg;
+      break;
+    case 'v':
+      vcd_file = optarg;
+      break;
+    case 'r':
+      isr = true;
+      break;
+    case 'c':
+      commands = optarg;
+      break;
+    case 'b':
+      bench = true;
+      break;
+    case 'x':
+      exact = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1 || knob < 0 || knob > 255) {
+    usage();
+  }
+
+  elf_firmware_t firmware = {};
+  if (elf_read_firmware(argv[optind], &firmware) != 0) {
+    fprintf(stderr, "%s: can't read firmware\n", argv[optind]);
+    return 1;
+  }
+  avr_t* avr = avr_make_mcu_by_name("attiny13");
+  if (!avr) {
+    fprintf(stderr, "simavr has no attiny13\n");
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &firmware);
+  avr->frequency = sim::cpu_hz;
+  avr->vcc = vcc_mv;
+
+  Harness h = {};
+  h.avr = avr;
+  h.sw = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), IOPORT_IRQ_PIN3);
+  h.knob = avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC2);
+  avr_irq_t* pwm =
+    avr_io_getirq(avr, AVR_IOCTL_TIMER_GETIRQ('0'), TIMER_IRQ_OUT_PWM0);
+  avr_irq_register_notify(pwm, print_pwm, &h);
+  h.expect = -1;
+  if (bench) {
+    avr_irq_register_notify(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ,
+					  ADC_IRQ_OUT_TRIGGER),
+			    count_conversion, &h);
+  }
+
+  avr_vcd_t vcd;
+  if (vcd_file) {
+    avr_vcd_init(avr, vcd_file, &vcd, 100000);
+    avr_vcd_add_signal(&vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+					   IOPORT_IRQ_PIN0), 1, "PB0");
+    avr_vcd_add_signal(&vcd, pwm, 8, "OCR0A");
+    // The profiling marks, for profile.
+    avr_vcd_add_signal(&vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+					   IOPORT_IRQ_PIN1), 1, "PB1");
+    avr_vcd_add_signal(&vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+					   IOPORT_IRQ_PIN2), 1, "PB2");
+    avr_vcd_add_signal(&vcd, avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+					   IOPORT_IRQ_PIN5), 1, "PB5");
+    avr_vcd_start(&vcd);
+  }
+
+  FILE* f = nullptr;
+  sim::TraceReader* reader = nullptr;
+  if (trace) {
+    f = fopen(trace, "rb");
+    if (!f) {
+      perror(trace);
+      return 1;
+    }
+    reader = new sim::TraceReader(f);
+    if (!reader->ok() || reader->hz != sim::cpu_hz) {
+      fprintf(stderr, "%s: not a trace at %u Hz\n", trace, sim::cpu_hz);
+      return 1;
+    }
+    h.reader = reader;
+    h.pending = reader->read(h.cycle, h.next_sw, h.next_knob);
+    if (h.pending) {
+      avr_cycle_timer_register(avr, h.cycle, apply_trace, &h);
+    }
+  }
+  else {
+    set_inputs(&h, sw, knob);
+  }
+
+  sim::Host host;
+  if (commands) {
+    if (!host.load(commands)) {
+      return 1;
+    }
+    h.host = &host;
+    h.line = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'),
+			   IOPORT_IRQ_PIN1);
+    avr_irq_register_notify(h.line, line_changed, &h);
+    avr_raise_irq(h.line, 1);	// Idle.
+    h.level = 1;
+    h.tx_start = host.serial(0, h.tx);
+    if (h.tx_start != UINT64_MAX) {
+      avr_cycle_timer_register(avr, h.tx_start, send_bit, &h);
+    }
+  }
+
+  // avr_run() runs one instruction, so the interrupt can be timed by
+  // watching the PC.
+  uint64_t end = sim::cycles(seconds);
+  uint64_t isr_start = 0;
+  bool in_isr = false;
+  uint64_t isr_runs = 0, isr_total = 0, isr_min = UINT64_MAX, isr_max = 0;
+  Skips skips;
+  while (avr->cycle < end) {
+    if (!exact) {
+      // Running any timers due first, as avr_run() has already done,
+      // gives the cycles to the next.
+      uint64_t limit = std::min<uint64_t>(avr_cycle_timer_process(avr),
+					  end - avr->cycle);
+      uint64_t n = fast_forward(avr, limit);
+      if (n) {
+	skips.runs++;
+	skips.cycles += n;
+	continue;
+      }
+    }
+    bool returning = false;
+    if (isr) {
+      if (avr->pc == tim0_ovf_vect) {
+	isr_start = avr->cycle;
+	in_isr = true;
+      }
+      returning = in_isr
+	&& (avr->flash[avr->pc] | avr->flash[avr->pc + 1] << 8) == reti;
+    }
+    int state = avr_run(avr);
+    if (state == cpu_Done || state == cpu_Crashed) {
+      fprintf(stderr, "firmware stopped at cycle %llu\n",
+	      (unsigned long long)avr->cycle);
+      return 1;
+    }
+    if (returning) {
+      uint64_t n = avr->cycle - isr_start;
+      isr_runs++;
+      isr_total += n;
+      isr_min = std::min(isr_min, n);
+      isr_max = std::max(isr_max, n);
+      in_isr = false;
+    }
+  }
+
+  if (isr) {
+    if (isr_runs) {
+      fprintf(stderr, "TIM0_OVF: %llu runs, %.1f cycles mean, "
+	      "%llu min, %llu max, %.2f%% of the CPU\n",
+	      (unsigned long long)isr_runs, (double)isr_total / isr_runs,
+	      (unsigned long long)isr_min, (unsigned long long)isr_max,
+	      100.0 * isr_total / avr->cycle);
+    }
+    else {
+      fprintf(stderr, "TIM0_OVF: never ran\n");
+    }
+  }
+
+  if (bench) {
+    if (h.conversions > 1) {
+      uint64_t n = h.conversions - 1;
+      uint64_t span = h.last_conversion - h.first_conversion;
+      fprintf(stderr, "ADC: %llu conversions, %.1f cycles apart, "
+	      "%.1f a second\n", (unsigned long long)h.conversions,
+	      (double)span / n, n / sim::seconds(span));
+    }
+    else {
+      fprintf(stderr, "ADC: %llu conversions\n",
+	      (unsigned long long)h.conversions);
+    }
+    fprintf(stderr, "skipped %.1f%% of the cycles in %llu idle loops\n",
+	    100.0 * skips.cycles / avr->cycle,
+	    (unsigned long long)skips.runs);
+  }
+
+  if (vcd_file) {
+    avr_vcd_stop(&vcd);
+  }
+
+  if (reader && !reader->ok()) {
+    fprintf(stderr, "%s: truncated\n", trace);
+    return 1;
+  }
+  return 0;
+}
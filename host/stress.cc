@@ -0,0 +1,541 @@
+// Interrupt interleaving stress test of the interrupt-driven builds,
+// and of spiro.h's Snapshot and Setpoint.
+//
+//   stress [-t seconds] [-n runs] [-j cycles] [-k knob] [-l ms]
+//          [-r seed] [-v]
+//
+// The model's interrupts land wherever their time falls among the
+// firmware's calls to the hardware policy, which is where the main
+// loop's state changes.  Each build is run -n times (default 16) for
+// -t seconds (default 20) with the knob at -k (default 255), the
+// switch toggled at random about every 2 seconds and, for REMOTE, a
+// query every half second.  The runs start the main loop at -n
+// evenly spaced points across a PWM period against the overflows and
+// a random point against the ADC's conversions, so -n 2048 puts the
+// overflow at every cycle of the loop.  -j adds a random 0 to -j - 1
+// cycle pause before every call too, which shuffles the interleaving
+// through the whole run.  -r seeds that (default 1).
+//
+// Checked on every run:
+//
+//   step     random ramps move OCR0A a count at a time, continuing
+//            from where it was, or in a SLEW build by no more than the
+//            rate allows, manual mode included
+//   toward   in a RAMP=isr build, each of the interrupt's writes is
+//            between the last and the ramp's target
+//   switch   a change is seen within -l ms (default 1000, one ramp at
+//            the knob's fastest, or 20 with SCHED, plus a -j pause for
+//            each of a ramp's 1024 or so calls), reported as the worst
+//            latency
+//
+// Then the interrupt is put at every load and store of a 16-bit
+// Snapshot read and a Setpoint write, and every result checked
+// against the old and new values; a plain copy is put through the
+// same as a control, which should tear.  -v prints each violation.
+//
+// This is the cost model, not the firmware.  Interrupts only land
+// between calls to the hardware policy, never inside one, so a race
+// within a call, like start_ramp()'s stores being reordered past the
+// one that starts the interrupt, can't show here.  And the torn-read
+// check is of the protocols on instrumented bytes, not of the
+// firmware's own state.  Interrupting the real ELF at every
+// instruction boundary would take spirosimavr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+
+#include "spiro.h"
+#include "sim.h"
+#include "serial.h"
+
+struct Options
+{
+  double seconds = 20;
+  int runs = 16;
+  uint32_t jitter = 0;
+  int knob = 255;
+  double limit_ms = -1;
+  uint32_t seed = 1;
+  bool verbose = false;
+};
+
+// The switch, toggled at random, and a REMOTE build's host.
+class Toggler : public sim::Input
+{
+public:
+  Toggler(std::mt19937& rng, uint64_t end, sim::Host* host)
+    : host(host)
+  {
+    std::exponential_distribution<double> gap(1 / 2.0);
+    for (uint64_t t = sim::cycles(gap(rng)); t < end;
+	 t += sim::cycles(gap(rng)) + 1) {
+      toggles.push_back(t);
+    }
+  }
+
+  std::vector<uint64_t> toggles;
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+    sw = level(cycle);
+  }
+
+  uint64_t
+  serial(uint64_t cycle, uint8_t& b) override
+  {
+    return host ? host->serial(cycle, b) : UINT64_MAX;
+  }
+
+  bool
+  level(uint64_t cycle) const
+  {
+    return (std::upper_bound(toggles.begin(), toggles.end(), cycle)
+	    - toggles.begin()) % 2;
+  }
+
+  // The last toggle at or before cycle, or 0.
+  uint64_t
+  changed(uint64_t cycle) const
+  {
+    auto i = std::upper_bound(toggles.begin(), toggles.end(), cycle);
+    return i == toggles.begin() ? 0 : *(i - 1);
+  }
+
+private:
+  sim::Host* host;
+};
+
+struct Counts
+{
+  uint64_t writes = 0;
+  uint64_t step = 0;
+  uint64_t toward = 0;
+  uint64_t late = 0;
+  uint64_t latency = 0;		// The worst, in cycles.
+};
+
+class Checker : public sim::Output
+{
+public:
+  Checker(const Toggler& toggler, uint8_t slew_rate, uint64_t limit,
+	  bool verbose, Counts& counts)
+    : toggler(toggler), limit(limit), verbose(verbose), counts(counts)
+  {
+    max_step = slew_rate ? (15 + slew_rate) / 16 : 1;
+    slew = slew_rate != 0;
+  }
+
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    counts.writes++;
+    if (last >= 0 && (on || slew) && abs(value - last) > max_step) {
+      counts.step++;
+      report(cycle, "step", "%d to %u", last, value);
+    }
+    if (ramping && !slew) {
+      int ip = to > last ? 1 : -1;
+      if ((value - last) * ip < 0 || (value - to) * ip > 0) {
+	counts.toward++;
+	report(cycle, "toward", "%d to %u, target %d", last, value, to);
+      }
+      if (value == to) {
+	ramping = false;
+      }
+    }
+    last = value;
+  }
+
+  // What switch_on() returned at cycle.
+  void
+  seen(uint64_t cycle, bool sw)
+  {
+    if (sw != on || first) {
+      uint64_t from = toggler.changed(cycle);
+      if (!first) {
+	uint64_t n = cycle - from;
+	counts.latency = std::max(counts.latency, n);
+	if (n > limit) {
+	  counts.late++;
+	  report(cycle, "switch", "seen %.1f ms late",
+		 1000 * sim::seconds(n));
+	}
+      }
+      on = sw;
+      first = false;
+    }
+  }
+
+  // Where the line ends, after the interrupt's 255 time steps.
+  void
+  start(const spiro::Line& line)
+  {
+    spiro::Line l = line;
+    for (int i = 1; i < 256; i++) {
+      l.step();
+    }
+    to = l.pwm;
+    ramping = to != line.pwm;
+  }
+
+private:
+  const Toggler& toggler;
+  uint64_t limit;
+  bool verbose;
+  Counts& counts;
+  int max_step;
+  bool slew;
+  int last = -1;
+  bool on = false;
+  bool first = true;
+  bool ramping = false;
+  int to = 0;
+
+  template<typename... A>
+  void
+  report(uint64_t cycle, const char* what, const char* fmt, A... a)
+  {
+    if (verbose) {
+      printf("  %10.6f s %-7s ", sim::seconds(cycle), what);
+      printf(fmt, a...);
+      printf("\n");
+    }
+  }
+};
+
+// S with a pause of up to jitter cycles before each call, and the
+// calls the checks need passed to the Checker.
+template<typename S>
+class Stress : public S
+{
+public:
+  Stress(uint64_t end, Checker& check, uint32_t jitter, uint32_t seed)
+    : S(end), check(check), jitter(jitter), rng(seed)
+  {
+  }
+
+  uint32_t adc_phase = 0;
+
+  void
+  init()
+  {
+    S::init();
+    if (this->sense) {
+      this->conversion += adc_phase;
+    }
+  }
+
+  uint8_t
+  read_adc()
+  {
+    pause();
+    return S::read_adc();
+  }
+
+  void
+  set_pwm(uint8_t pwm)
+  {
+    pause();
+    S::set_pwm(pwm);
+  }
+
+  void
+  kick()
+  {
+    pause();
+    S::kick();
+  }
+
+  bool
+  switch_on()
+  {
+    pause();
+    bool on = S::switch_on();
+    check.seen(this->cycle, on);
+    return on;
+  }
+
+  void
+  delay_loop_1(uint8_t count)
+  {
+    pause();
+    S::delay_loop_1(count);
+  }
+
+  void
+  start_ramp(const spiro::Line& line, uint8_t rate)
+  {
+    pause();
+    check.start(line);
+    S::start_ramp(line, rate);
+  }
+
+  bool
+  ramping()
+  {
+    pause();
+    return S::ramping();
+  }
+
+  void
+  set_ramp_rate(uint8_t rate)
+  {
+    pause();
+    S::set_ramp_rate(rate);
+  }
+
+private:
+  Checker& check;
+  uint32_t jitter;
+  std::mt19937 rng;
+
+  void
+  pause()
+  {
+    if (jitter) {
+      S::spend(rng() % jitter);
+    }
+  }
+};
+
+enum Kind { kind_busy, kind_isr, kind_sched };
+
+struct Build
+{
+  const char* name;
+  Kind kind;
+  bool sense;
+  bool remote;
+  uint8_t slew_rate;
+};
+
+const Build builds[] = {
+  { "busy", kind_busy, false, false, 0 },
+  { "busy sense", kind_busy, true, false, 0 },
+  { "busy remote", kind_busy, false, true, 0 },
+  { "busy slew", kind_busy, false, false, 32 },
+  { "isr", kind_isr, false, false, 0 },
+  { "isr sense", kind_isr, true, false, 0 },
+  { "isr remote", kind_isr, false, true, 0 },
+  { "isr slew", kind_isr, false, false, 32 },
+  { "sched", kind_sched, false, false, 0 },
+  { "sched sense", kind_sched, true, false, 0 },
+  { "sched remote", kind_sched, false, true, 0 },
+};
+
+template<typename S>
+static void
+run(const Build& b, const Options& o, int i, std::mt19937& rng,
+    Counts& counts)
+{
+  uint64_t end = sim::cycles(o.seconds);
+  sim::Host host;
+  if (b.remote) {
+    for (double t = 0.5; t < o.seconds; t += 0.5) {
+      host.commands.push_back(sim::Host::Command{sim::cycles(t), 'q', 0});
+    }
+  }
+  Toggler toggler(rng, end, b.remote ? &host : nullptr);
+  uint64_t limit = o.limit_ms >= 0 ? sim::cycles(o.limit_ms / 1000)
+    : sim::cycles(b.kind == kind_sched ? 0.020 : 1.0) + 1024 * o.jitter;
+  Checker check(toggler, b.slew_rate, limit, o.verbose, counts);
+  Stress<S> hw(end, check, o.jitter, rng());
+  hw.knob = o.knob;
+  hw.sense = b.sense;
+  hw.remote = b.remote;
+  hw.slew_rate = b.slew_rate;
+  hw.input = &toggler;
+  hw.output = &check;
+  hw.costs.init += (uint64_t)i * sim::pwm_period / o.runs;
+  hw.adc_phase = rng() % (13 * sim::adc_prescale + hw.costs.adc_isr);
+  if constexpr (S::isr_ramp && !S::sched) {
+    hw.c_isr();
+  }
+  try {
+    spiro::Spiro<Stress<S>, sim::Tuning>(hw, sim::Tuning()).run();
+  }
+  catch (sim::Sim::Done&) {
+  }
+}
+
+// A byte whose every copy is a point the interrupt can come at.
+struct Byte
+{
+  uint8_t v;
+
+  static int points;		// Counted off as they go by,
+  static int at;		// and the one to interrupt at.
+  static void (*isr)();
+
+  Byte&
+  operator=(const Byte& b)
+  {
+    point();
+    v = b.v;
+    point();
+    return *this;
+  }
+
+  static void
+  point()
+  {
+    if (points++ == at && isr) {
+      void (*f)() = isr;
+      isr = nullptr;		// It can't interrupt itself.
+      f();
+    }
+  }
+};
+
+int Byte::points;
+int Byte::at;
+void (*Byte::isr)();
+
+struct Pair
+{
+  Byte lo, hi;
+
+  uint16_t
+  value() const
+  {
+    return lo.v | hi.v << 8;
+  }
+};
+
+const Pair old_value = { {0xFF}, {0x00} };
+const Pair new_value = { {0x00}, {0x01} };
+
+static spiro::Snapshot<Pair> snapshot;
+static spiro::Setpoint<Pair> setpoint;
+static Pair plain;
+static uint16_t isr_read;
+
+// Interrupts each of point 0, 1, ... of what main() does in turn until
+// it gets through without one.  Returns the points, and counts the
+// results that are neither the old nor the new value.
+template<typename Reset, typename Main>
+static int
+interleave(Reset reset, void (*isr)(), Main main, int& torn)
+{
+  torn = 0;
+  for (int at = 0; ; at++) {
+    reset();
+    Byte::points = 0;
+    Byte::at = at;
+    Byte::isr = isr;
+    uint16_t got = main();
+    bool interrupted = Byte::isr == nullptr;
+    if (got != old_value.value() && got != new_value.value()) {
+      torn++;
+    }
+    if (!interrupted) {
+      return at;
+    }
+  }
+}
+
+static void
+protocols()
+{
+  int torn;
+  int points = interleave(
+    [] { snapshot.value = old_value; snapshot.seq = 0; },
+    [] { snapshot.write(new_value); },
+    [] { return snapshot.read().value(); }, torn);
+  printf("%-22s %3d points %3d torn\n", "Snapshot read", points, torn);
+
+  points = interleave(
+    [] { setpoint = spiro::Setpoint<Pair>(); setpoint.write(old_value); },
+    [] { isr_read = setpoint.read().value(); },
+    [] { setpoint.write(new_value); return isr_read; }, torn);
+  printf("%-22s %3d points %3d torn\n", "Setpoint write", points, torn);
+
+  points = interleave(
+    [] { plain = old_value; },
+    [] { plain = new_value; },
+    [] { Pair p; p = plain; return p.value(); }, torn);
+  printf("%-22s %3d points %3d torn   (control)\n", "plain copy", points,
+	 torn);
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: stress [-t seconds] [-n runs] [-j cycles] "
+	  "[-k knob] [-l ms] [-r seed] [-v]\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  Options o;
+  int c;
+  while ((c = getopt(argc, argv, "t:n:j:k:l:r:v")) != -1) {
+    switch (c) {
+    case 't':
+      o.seconds = atof(optarg);
+      break;
+    case 'n':
+      o.runs = atoi(optarg);
+      break;
+    case 'j':
+      o.jitter = atoi(optarg);
+      break;
+    case 'k':
+      o.knob = atoi(optarg);
+      break;
+    case 'l':
+      o.limit_ms = atof(optarg);
+      break;
+    case 'r':
+      o.seed = strtoul(optarg, nullptr, 0);
+      break;
+    case 'v':
+      o.verbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || o.seconds <= 0 || o.runs < 1 || o.knob < 0
+      || o.knob > 255) {
+    usage();
+  }
+
+  printf("%-14s %9s %6s %6s %6s %10s\n", "build", "writes", "step",
+	 "toward", "switch", "latency");
+  std::mt19937 rng(o.seed);
+  bool ok = true;
+  for (const Build& b : builds) {
+    Counts counts;
+    for (int i = 0; i < o.runs; i++) {
+      if (o.verbose) {
+	printf("%s run %d\n", b.name, i);
+      }
+      switch (b.kind) {
+      case kind_busy:
+	run<sim::Sim>(b, o, i, rng, counts);
+	break;
+      case kind_isr:
+	run<sim::IsrSim>(b, o, i, rng, counts);
+	break;
+      case kind_sched:
+	run<sim::SchedSim>(b, o, i, rng, counts);
+	break;
+      }
+    }
+    printf("%-14s %9llu %6llu %6llu %6llu %7.1f ms\n", b.name,
+	   (unsigned long long)counts.writes, (unsigned long long)counts.step,
+	   (unsigned long long)counts.toward, (unsigned long long)counts.late,
+	   1000 * sim::seconds(counts.latency));
+    ok = ok && !counts.step && !counts.toward && !counts.late;
+  }
+  printf("\n");
+  protocols();
+  return ok ? 0 : 1;
+}
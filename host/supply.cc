@@ -0,0 +1,153 @@
+// What a SUPPLY=1 build's compensation does for the fan's speed as
+// the supply drops, and what it costs.
+//
+//   supply [-m pwm_min] [-k step] [-t seconds]
+//
+// For supplies from 2.0V to 3.6V and every -k'th knob position
+// (default 32), the speed the duty settles to in manual mode without
+// compensation and with, from spiro::Supply's gain for the divider's
+// reading, and each way's worst distance from the speed at 3.3V as a
+// percentage of it.  Below 3.3V the top of the knob can't be made up,
+// as the duty is already full, so those positions are marked * and
+// left out of the error either way.
+//
+// Then -t seconds (default 60) of each build with the switch off and
+// on, with and without SUPPLY: the main loop's knob reads a second,
+// and the share of the CPU active.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "motor.h"
+
+const double supplies[] = { 2.0, 2.4, 2.8, 3.0, 3.3, 3.6 };
+
+struct Run
+{
+  double reads;			// a second
+  double active;		// %
+};
+
+template<typename S>
+static Run
+run(double seconds, bool sw, bool supply)
+{
+  S hw(sim::cycles(seconds));
+  hw.knob = 128;
+  hw.sw = sw;
+  hw.supply = supply;
+  try {
+    spiro::Spiro<S>(hw).run();
+  }
+  catch (sim::Sim::Done&) {
+  }
+  return Run{hw.adc_reads / seconds,
+	     100.0 * hw.usage.cpu[sim::active] / hw.cycle};
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: supply [-m pwm_min] [-k step] [-t seconds]\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  int pwm_min = spiro::DefaultTuning::pwm_min;
+  int step = 32;
+  double seconds = 60;
+
+  int c;
+  while ((c = getopt(argc, argv, "m:k:t:")) != -1) {
+    switch (c) {
+    case 'm':
+      pwm_min = atoi(optarg);
+      break;
+    case 'k':
+      step = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc || pwm_min < 0 || pwm_min > 255 || step < 1
+      || step > 255 || seconds <= 0) {
+    usage();
+  }
+
+  std::vector<int> knobs;
+  for (int in = 0; in < 256; in += step) {
+    knobs.push_back(in);
+  }
+  if (knobs.back() != 255) {
+    knobs.push_back(255);
+  }
+
+  std::vector<double> nominal;
+  sim::Rig fan;
+  for (int in : knobs) {
+    nominal.push_back(sim::rpm(fan.target(spiro::scale_pwm(in, pwm_min))));
+  }
+
+  for (int compensate = 0; compensate < 2; compensate++) {
+    printf("%s\n%-6s %4s %4s", compensate ? "with SUPPLY" : "without",
+	   "VCC", "adc", "gain");
+    for (int in : knobs) {
+      printf(" %5d ", in);
+    }
+    printf(" %6s\n", "error");
+    for (double vcc : supplies) {
+      sim::MotorParams p;
+      p.supply = vcc;
+      sim::Rig rig(p);
+      uint8_t v = sim::supply_reading(vcc);
+      spiro::Supply full = {128};
+      full.reading(v, sim::supply_nominal);
+      spiro::Supply s = compensate ? full : spiro::Supply{128};
+      printf("%5.1fV %4u %4u", vcc, v, s.gain);
+      double error = 0;
+      for (size_t i = 0; i < knobs.size(); i++) {
+	uint8_t pwm = spiro::scale_pwm(knobs[i], pwm_min);
+	double speed = sim::rpm(rig.target(s.multiply(pwm)));
+	bool made_up = full.gain <= 128 || full.multiply(pwm) < 0xFF;
+	printf(" %5.0f%c", speed, made_up ? ' ' : '*');
+	if (made_up && nominal[i] > 0) {
+	  error = std::max(error, fabs(speed - nominal[i]) / nominal[i]);
+	}
+      }
+      printf(" %5.1f%%\n", 100 * error);
+    }
+    printf("\n");
+  }
+
+  printf("%-14s %22s %22s\n", "", "reads/s", "active");
+  printf("%-14s %10s %11s %10s %11s\n", "", "off", "SUPPLY", "off",
+	 "SUPPLY");
+  for (int sched = 0; sched < 2; sched++) {
+    for (int sw = 0; sw < 2; sw++) {
+      Run off, on;
+      if (sched) {
+	off = run<sim::SchedSim>(seconds, sw, false);
+	on = run<sim::SchedSim>(seconds, sw, true);
+      }
+      else {
+	off = run<sim::Sim>(seconds, sw, false);
+	on = run<sim::Sim>(seconds, sw, true);
+      }
+      printf("%-5s %-8s %10.0f %11.0f %9.3f%% %10.3f%%\n",
+	     sched ? "sched" : "busy", sw ? "random" : "manual",
+	     off.reads, on.reads, off.active, on.active);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,345 @@
+// Run the control logic over a grid of tuning parameters and input
+// traces, in parallel, and write the metrics for each run as CSV.
+//
+//   sweep [-j jobs] [-t seconds] [-r traces] [-i script]... [name=values]...
+//
+// Each name is a field of sim::Tuning and values is a comma separated
+// list of numbers or a range lo:hi:step, for example
+//
+//   sweep -r 8 pwm_min=0,32,64 ramp_bias=5:20:5 ramp_delay=4,6,8
+//
+// Every combination is run against every trace.  Traces are the
+// scripts given with -i, or if there are none, -r random traces
+// (default 4) that turn the knob and flip the switch every few
+// seconds.  The random traces depend only on their index so runs are
+// repeatable.
+//
+// Metrics per run:
+//
+//   ramps          random ramps completed
+//   ramp_s_*       ramp duration, seconds
+//   step_ms_*      time between OCR0A writes within a ramp, ms
+//   coverage       fraction of the possible ramp targets reached
+//   energy_mwh     motor energy from the fan model
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <atomic>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spiro.h"
+#include "sim.h"
+#include "script.h"
+#include "motor.h"
+
+struct Param
+{
+  const char* name;
+  long lo, hi;
+  long (*get)(const sim::Tuning&);
+  void (*set)(sim::Tuning&, long);
+};
+
+#define PARAM(name, lo, hi) \
+  { #name, lo, hi, \
+    [](const sim::Tuning& t) -> long { return t.name; }, \
+    [](sim::Tuning& t, long v) { t.name = v; } }
+
+static const Param params[] = {
+  PARAM(pwm_min, 0, 255),
+  PARAM(kick_ms, 0, 10000),
+  PARAM(ramp_counter, 1, 32767),
+  // The counter must always go down, even with the knob at 0.
+  PARAM(ramp_bias, 1, 32767 - 255),
+  PARAM(ramp_delay, 0, 255),
+  PARAM(lcg_shift, 1, 15),
+  PARAM(lcg_inc, 0, 0xFFFF),
+};
+
+const size_t nparams = sizeof params / sizeof params[0];
+
+// The hardware policy with some watching.  A ramp starts each time
+// switch_on() returns true and ends at the next call, and the PWM
+// value then is the ramp's target.
+
+class Probe : public sim::Sim
+{
+public:
+  using Sim::Sim;
+
+  uint64_t ramps = 0;
+  double ramp_total = 0;
+  double ramp_max = 0;
+  uint64_t steps = 0;
+  double step_total = 0;
+  double step_squares = 0;
+  bool targets[256] = {};
+
+  bool
+  switch_on()
+  {
+    bool on = Sim::switch_on();
+    end_ramp();
+    if (on) {
+      ramp_start = cycle;
+      last_write = cycle;
+    }
+    ramping = on;
+    return on;
+  }
+
+  void
+  set_pwm(uint8_t pwm)
+  {
+    Sim::set_pwm(pwm);
+    if (ramping) {
+      double t = sim::seconds(cycle - last_write);
+      steps++;
+      step_total += t;
+      step_squares += t * t;
+      last_write = cycle;
+    }
+  }
+
+private:
+  bool ramping = false;
+  uint64_t ramp_start = 0;
+  uint64_t last_write = 0;
+
+  void
+  end_ramp()
+  {
+    if (ramping) {
+      double t = sim::seconds(cycle - ramp_start);
+      ramps++;
+      ramp_total += t;
+      if (t > ramp_max) {
+	ramp_max = t;
+      }
+      targets[ocr0a] = true;
+    }
+  }
+};
+
+static std::vector<sim::Script::Step>
+random_trace(unsigned index, double seconds)
+{
+  std::mt19937 gen(index);
+  std::uniform_real_distribution<double> hold(1, 5);
+  std::uniform_int_distribution<int> knob(0, 255);
+  std::bernoulli_distribution sw(0.75);
+
+  std::vector<sim::Script::Step> steps;
+  for (double t = 0; t < seconds; t += hold(gen)) {
+    steps.push_back(sim::Script::Step{sim::cycles(t), sw(gen),
+				      (uint8_t)knob(gen)});
+  }
+  return steps;
+}
+
+// Parses "lo:hi:step" or "a,b,c" into values.  Returns false if it
+// doesn't parse.
+static bool
+parse_values(const char* s, std::vector<long>& values)
+{
+  char* end;
+  long lo = strtol(s, &end, 0);
+  if (end == s) {
+    return false;
+  }
+  if (*end == ':') {
+    char* p = end + 1;
+    long hi = strtol(p, &end, 0);
+    if (end == p || *end != ':') {
+      return false;
+    }
+    p = end + 1;
+    long step = strtol(p, &end, 0);
+    if (end == p || *end || step <= 0) {
+      return false;
+    }
+    for (long v = lo; v <= hi; v += step) {
+      values.push_back(v);
+    }
+    return !values.empty();
+  }
+  values.push_back(lo);
+  while (*end == ',') {
+    char* p = end + 1;
+    values.push_back(strtol(p, &end, 0));
+    if (end == p) {
+      return false;
+    }
+  }
+  return *end == '\0';
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: sweep [-j jobs] [-t seconds] [-r traces] "
+	  "[-i script]... [name=values]...\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  unsigned jobs = std::thread::hardware_concurrency();
+  double seconds = 60;
+  unsigned ntraces = 4;
+  std::vector<const char*> scripts;
+
+  int c;
+  while ((c = getopt(argc, argv, "j:t:r:i:")) != -1) {
+    switch (c) {
+    case 'j':
+      jobs = atoi(optarg);
+      break;
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'r':
+      ntraces = atoi(optarg);
+      break;
+    case 'i':
+      scripts.push_back(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (jobs < 1) {
+    jobs = 1;
+  }
+
+  // The values for each parameter, defaulting to the firmware's.
+  std::vector<std::vector<long>> values(nparams);
+  for (int i = optind; i < argc; i++) {
+    const char* eq = strchr(argv[i], '=');
+    size_t p;
+    for (p = 0; p < nparams; p++) {
+      if (eq && strlen(params[p].name) == (size_t)(eq - argv[i])
+	  && strncmp(params[p].name, argv[i], eq - argv[i]) == 0) {
+	break;
+      }
+    }
+    if (p == nparams || !values[p].empty()
+	|| !parse_values(eq + 1, values[p])) {
+      fprintf(stderr, "sweep: bad parameter %s\n", argv[i]);
+      usage();
+    }
+    for (long v : values[p]) {
+      if (v < params[p].lo || v > params[p].hi) {
+	fprintf(stderr, "sweep: %s must be %ld to %ld\n",
+		params[p].name, params[p].lo, params[p].hi);
+	return 2;
+      }
+    }
+  }
+  sim::Tuning defaults;
+  for (size_t p = 0; p < nparams; p++) {
+    if (values[p].empty()) {
+      values[p].push_back(params[p].get(defaults));
+    }
+  }
+
+  std::vector<std::vector<sim::Script::Step>> traces;
+  std::vector<std::string> trace_names;
+  for (const char* s : scripts) {
+    sim::Script script;
+    if (!script.load(s)) {
+      return 1;
+    }
+    traces.push_back(script.steps);
+    trace_names.push_back(s);
+  }
+  if (scripts.empty()) {
+    for (unsigned i = 0; i < ntraces; i++) {
+      traces.push_back(random_trace(i, seconds));
+      trace_names.push_back("random" + std::to_string(i));
+    }
+  }
+
+  size_t combos = 1;
+  for (auto& v : values) {
+    combos *= v.size();
+  }
+  size_t runs = combos * traces.size();
+  std::vector<std::string> results(runs);
+  std::atomic<size_t> next(0);
+
+  auto worker = [&]() {
+    size_t run;
+    while ((run = next++) < runs) {
+      size_t combo = run / traces.size();
+      size_t trace = run % traces.size();
+
+      sim::Tuning tuning;
+      std::string line;
+      size_t rest = combo;
+      for (size_t p = 0; p < nparams; p++) {
+	long v = values[p][rest % values[p].size()];
+	rest /= values[p].size();
+	params[p].set(tuning, v);
+	line += std::to_string(v) + ",";
+      }
+      line += trace_names[trace];
+
+      Probe hw(sim::cycles(seconds));
+      sim::Script script;
+      script.steps = traces[trace];
+      hw.input = &script;
+      sim::Rig rig;
+      hw.output = &rig;
+      try {
+	spiro::Spiro<Probe, sim::Tuning>(hw, tuning).run();
+      }
+      catch (sim::Sim::Done&) {
+      }
+      rig.run(hw.cycle);
+
+      double step_mean = hw.steps ? hw.step_total / hw.steps : 0;
+      double step_var = hw.steps ?
+	hw.step_squares / hw.steps - step_mean * step_mean : 0;
+      int reached = 0;
+      for (int i = tuning.pwm_min; i < 256; i++) {
+	reached += hw.targets[i];
+      }
+      double joules = rig.charge * rig.motor.dt * rig.motor.p.supply;
+
+      char buf[256];
+      snprintf(buf, sizeof buf, ",%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.4f",
+	       (unsigned long long)hw.ramps,
+	       hw.ramps ? hw.ramp_total / hw.ramps : 0, hw.ramp_max,
+	       1000 * step_mean, 1000 * sqrt(step_var > 0 ? step_var : 0),
+	       (double)reached / (256 - tuning.pwm_min), joules / 3.6);
+      results[run] = line + buf;
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < jobs; i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (size_t p = 0; p < nparams; p++) {
+    printf("%s,", params[p].name);
+  }
+  printf("trace,ramps,ramp_s_mean,ramp_s_max,step_ms_mean,step_ms_jitter,"
+	 "coverage,energy_mwh\n");
+  for (auto& r : results) {
+    printf("%s\n", r.c_str());
+  }
+
+  return 0;
+}
@@ -0,0 +1,183 @@
+// Record, inspect and replay input traces (see trace.h).
+//
+//   trace record [-t seconds] [-k knob] [-s] [script] >file
+//   trace dump file
+//   trace play [-t seconds] file
+//
+// record runs the control logic against an input script, or a fixed
+// knob and switch, and writes the inputs it samples.  dump prints a
+// trace as an input script.  play replays a trace and prints "cycle
+// pwm" for every OCR0A write, so the output of two builds can be
+// diffed.  A file of "-" is stdin.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "spiro.h"
+#include "sim.h"
+#include "script.h"
+#include "trace.h"
+
+class Print : public sim::Output
+{
+public:
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    printf("%llu %u\n", (unsigned long long)cycle, value);
+  }
+};
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+	  "usage: trace record [-t seconds] [-k knob] [-s] [script] >file\n"
+	  "       trace dump file\n"
+	  "       trace play [-t seconds] file\n");
+  exit(2);
+}
+
+static FILE*
+open_trace(const char* filename)
+{
+  if (strcmp(filename, "-") == 0) {
+    return stdin;
+  }
+  FILE* f = fopen(filename, "rb");
+  if (!f) {
+    perror(filename);
+    exit(1);
+  }
+  return f;
+}
+
+static void
+run(sim::Sim& hw)
+{
+  try {
+    spiro::Spiro<sim::Sim>(hw).run();
+  }
+  catch (sim::Sim::Done&) {
+  }
+}
+
+static int
+record(const char* script_file, double seconds, int knob, bool sw)
+{
+  if (isatty(fileno(stdout))) {
+    fprintf(stderr, "trace: not writing a trace to a terminal\n");
+    return 2;
+  }
+
+  sim::Script script;
+  if (script_file && !script.load(script_file)) {
+    return 1;
+  }
+
+  sim::Sim hw(sim::cycles(seconds));
+  hw.knob = knob;
+  hw.sw = sw;
+
+  sim::TraceWriter writer(stdout);
+  sim::TraceRecorder recorder(script_file ? &script : nullptr, writer);
+  hw.input = &recorder;
+  run(hw);
+
+  return ferror(stdout) ? 1 : 0;
+}
+
+static int
+dump(const char* filename)
+{
+  FILE* f = open_trace(filename);
+  sim::TraceReader reader(f);
+  if (!reader.ok()) {
+    fprintf(stderr, "%s: not a trace\n", filename);
+    return 1;
+  }
+
+  printf("# %u Hz\n# seconds switch knob\n", reader.hz);
+  uint64_t cycle;
+  bool sw;
+  uint8_t knob;
+  while (reader.read(cycle, sw, knob)) {
+    printf("%.6f %d %u	# %llu\n", (double)cycle / reader.hz, sw, knob,
+	   (unsigned long long)cycle);
+  }
+  if (!reader.eof()) {
+    fprintf(stderr, "%s: truncated\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+static int
+play(const char* filename, double seconds)
+{
+  FILE* f = open_trace(filename);
+  sim::TraceReader reader(f);
+  if (!reader.ok() || reader.hz != sim::cpu_hz) {
+    fprintf(stderr, "%s: not a trace at %u Hz\n", filename, sim::cpu_hz);
+    return 1;
+  }
+
+  sim::Sim hw(sim::cycles(seconds));
+  sim::TracePlayer player(reader);
+  Print print;
+  hw.input = &player;
+  hw.output = &print;
+  run(hw);
+
+  if (!reader.ok()) {
+    fprintf(stderr, "%s: truncated\n", filename);
+    return 1;
+  }
+  return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+  if (argc < 2) {
+    usage();
+  }
+  const char* cmd = argv[1];
+  argc--;
+  argv++;
+
+  double seconds = 10;
+  int knob = 128;
+  bool sw = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "t:k:s")) != -1) {
+    switch (c) {
+    case 't':
+      seconds = atof(optarg);
+      break;
+    case 'k':
+      knob = atoi(optarg);
+      break;
+    case 's':
+      sw = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  int nargs = argc - optind;
+
+  if (strcmp(cmd, "record") == 0 && nargs <= 1 && knob >= 0 && knob <= 255) {
+    return record(nargs ? argv[optind] : nullptr, seconds, knob, sw);
+  }
+  if (strcmp(cmd, "dump") == 0 && nargs == 1) {
+    return dump(argv[optind]);
+  }
+  if (strcmp(cmd, "play") == 0 && nargs == 1) {
+    return play(argv[optind], seconds);
+  }
+  usage();
+}
@@ -0,0 +1,209 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sim.h"
+
+// A compact streaming format for the switch and knob inputs over time,
+// for recording a run and replaying it exactly.
+//
+// The file starts with a header:
+//
+//   "SPTR"  magic
+//   1       format version
+//   u32     CPU clock in Hz, little-endian
+//
+// followed by one record per input change until EOF:
+//
+//   varint  (cycles since the previous record << 1) | switch
+//   u8      knob
+//
+// where a varint is 7 bits per byte, least significant first, with the
+// top bit set on all but the last byte.  Time is in CPU cycles so a
+// replay lands on exactly the cycles that were recorded.  A change
+// every few milliseconds costs three or four bytes.
+
+namespace sim {
+
+const char trace_magic[4] = {'S', 'P', 'T', 'R'};
+const uint8_t trace_version = 1;
+
+class TraceWriter
+{
+public:
+  // Writes the header.
+  explicit
+  TraceWriter(FILE* f)
+    : f(f)
+  {
+    fwrite(trace_magic, 1, 4, f);
+    putc(trace_version, f);
+    for (int i = 0; i < 4; i++) {
+      putc((uint8_t)(cpu_hz >> (8 * i)), f);
+    }
+  }
+
+  void
+  write(uint64_t cycle, bool sw, uint8_t knob)
+  {
+    uint64_t v = ((cycle - last) << 1) | sw;
+    while (v >= 0x80) {
+      putc((uint8_t)(v | 0x80), f);
+      v >>= 7;
+    }
+    putc((uint8_t)v, f);
+    putc(knob, f);
+    last = cycle;
+  }
+
+private:
+  FILE* f;
+  uint64_t last = 0;
+};
+
+class TraceReader
+{
+public:
+  // Reads the header.  Check ok() afterwards.
+  explicit
+  TraceReader(FILE* f)
+    : f(f)
+  {
+    char magic[4];
+    uint8_t rest[5];
+    good = fread(magic, 1, 4, f) == 4 && memcmp(magic, trace_magic, 4) == 0
+      && fread(rest, 1, 5, f) == 5 && rest[0] == trace_version;
+    if (good) {
+      hz = rest[1] | rest[2] << 8 | rest[3] << 16 | (uint32_t)rest[4] << 24;
+    }
+  }
+
+  // False if the header was wrong or a record was truncated.
+  bool
+  ok() const
+  {
+    return good;
+  }
+
+  uint32_t hz = 0;
+
+  // Reads the next record.  Returns false at EOF or on error.
+  bool
+  read(uint64_t& cycle, bool& sw, uint8_t& knob)
+  {
+    if (!good) {
+      return false;
+    }
+    uint64_t v = 0;
+    int c;
+    for (int shift = 0; ; shift += 7) {
+      c = getc(f);
+      if (c == EOF || shift > 63) {
+	// EOF is only clean between records.
+	good = c == EOF && shift == 0;
+	if (good) {
+	  at_end = true;
+	}
+	return false;
+      }
+      v |= (uint64_t)(c & 0x7F) << shift;
+      if (!(c & 0x80)) {
+	break;
+      }
+    }
+    c = getc(f);
+    if (c == EOF) {
+      good = false;
+      return false;
+    }
+    last += v >> 1;
+    cycle = last;
+    sw = v & 1;
+    knob = c;
+    return true;
+  }
+
+  bool
+  eof() const
+  {
+    return at_end;
+  }
+
+private:
+  FILE* f;
+  bool good;
+  bool at_end = false;
+  uint64_t last = 0;
+};
+
+// Replays a trace as simulator input, reading it as time goes by.
+class TracePlayer : public Input
+{
+public:
+  explicit
+  TracePlayer(TraceReader& reader)
+    : reader(reader)
+  {
+    pending = reader.read(next.cycle, next.sw, next.knob);
+  }
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+    while (pending && next.cycle <= cycle) {
+      knob = next.knob;
+      sw = next.sw;
+      pending = reader.read(next.cycle, next.sw, next.knob);
+    }
+  }
+
+private:
+  struct Record
+  {
+    uint64_t cycle;
+    bool sw;
+    uint8_t knob;
+  };
+
+  TraceReader& reader;
+  Record next;
+  bool pending;
+};
+
+// Passes another input through and records each change the firmware
+// sees, at the cycle it sees it.
+class TraceRecorder : public Input
+{
+public:
+  TraceRecorder(Input* input, TraceWriter& writer)
+    : input(input), writer(writer)
+  {
+  }
+
+  void
+  at(uint64_t cycle, uint8_t& knob, bool& sw) override
+  {
+    if (input) {
+      input->at(cycle, knob, sw);
+    }
+    if (first || knob != last_knob || sw != last_sw) {
+      writer.write(cycle, sw, knob);
+      first = false;
+      last_knob = knob;
+      last_sw = sw;
+    }
+  }
+
+private:
+  Input* input;
+  TraceWriter& writer;
+  bool first = true;
+  uint8_t last_knob = 0;
+  bool last_sw = false;
+};
+
+} // namespace sim
+
+#endif // TRACE_H
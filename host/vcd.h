@@ -0,0 +1,143 @@
+#ifndef VCD_H
+#define VCD_H
+
+#include <stdio.h>
+
+#include "sim.h"
+
+// Writes the simulated PB0/OC0A pin and OCR0A as a VCD file, like the
+// traces simavr produces, for vcdpwm and waveform viewers.  The pin
+// comes from the Timer0 model so it shows OCR0A's double buffering.
+// The profiling marks go on PB1, PB2 and PB5 as a PROFILE build puts
+// them, for profile.  A SENSE build cutting the output holds the pin
+// low.
+
+namespace sim {
+
+class VcdWriter : public Output
+{
+public:
+  explicit
+  VcdWriter(FILE* f)
+    : f(f)
+  {
+    fprintf(f,
+	    "$timescale 1ns $end\n"
+	    "$scope module spiro $end\n"
+	    "$var wire 1 ! PB0 $end\n"
+	    "$var reg 8 \" OCR0A $end\n"
+	    "$var wire 1 & PB1 $end\n"
+	    "$var wire 1 ' PB2 $end\n"
+	    "$var wire 1 ( PB5 $end\n"
+	    "$upscope $end\n"
+	    "$enddefinitions $end\n"
+	    "#0\n"
+	    "0!\n"
+	    "b0 \"\n"
+	    "0&\n"
+	    "0'\n"
+	    "0(\n");
+  }
+
+  Timer0 timer;
+
+  void
+  pwm(uint64_t cycle, uint8_t value) override
+  {
+    run(cycle);
+    timer.ocr_buffer = value;
+    driven = true;
+    stamp(cycle);
+    fprintf(f, "b");
+    for (int bit = 7; bit >= 0; bit--) {
+      putc('0' + ((value >> bit) & 1), f);
+    }
+    fprintf(f, " \"\n");
+  }
+
+  void
+  mark(uint64_t cycle, uint8_t m) override
+  {
+    run(cycle);
+    stamp(cycle);
+    uint8_t changed = m ^ marked;
+    for (int bit = 0; bit < 3; bit++) {
+      if (changed & (1 << bit)) {
+	fprintf(f, "%d%c\n", (m >> bit) & 1, "&'("[bit]);
+      }
+    }
+    marked = m;
+  }
+
+  void
+  cut(uint64_t cycle, bool off) override
+  {
+    run(cycle);
+    this->off = off;
+    if (off) {
+      set(cycle, false);
+      fall = 0;
+    }
+  }
+
+  // Write the pin's edges up to cycle.
+  void
+  run(uint64_t cycle)
+  {
+    uint64_t period = 256 * timer.prescale;
+    for (;;) {
+      uint64_t next = fall ? fall : start;
+      if (next > cycle) {
+	break;
+      }
+      if (next == start) {
+	// BOTTOM: latch OCR0A, set the pin, and find when it clears.
+	timer.ocr = timer.ocr_buffer;
+	if (driven && !off) {
+	  set(start, true);
+	  fall = timer.ocr == 0xFF ? 0
+	    : start + (timer.ocr + 1) * timer.prescale;
+	}
+	start += period;
+      }
+      else {
+	set(fall, false);
+	fall = 0;
+      }
+    }
+  }
+
+private:
+  FILE* f;
+  bool driven = false;
+  bool off = false;
+  bool level = false;
+  uint8_t marked = 0;
+  uint64_t start = 0;		// Start of the next timer period.
+  uint64_t fall = 0;		// When the pin next clears, or 0.
+  uint64_t last = 0;		// Time of the last stamp.
+
+  void
+  set(uint64_t cycle, bool high)
+  {
+    if (high != level) {
+      level = high;
+      stamp(cycle);
+      fprintf(f, "%d!\n", high);
+    }
+  }
+
+  void
+  stamp(uint64_t cycle)
+  {
+    uint64_t ns = (cycle * 1000000000 + cpu_hz / 2) / cpu_hz;
+    if (ns != last) {
+      fprintf(f, "#%llu\n", (unsigned long long)ns);
+      last = ns;
+    }
+  }
+};
+
+} // namespace sim
+
+#endif // VCD_H
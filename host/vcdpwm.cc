@@ -0,0 +1,286 @@
+// Analyze the PWM output in a VCD trace, from simavr or spirosim -v.
+//
+//   vcdpwm [-p pin] [-o ocr] [-f Hz] [-e percent] [-q] file.vcd
+//
+// Reports the PWM frequency, a histogram of the duty cycle, glitches,
+// and the timing of ramp steps, and checks the frequency against what
+// spiro.cc configures: 600kHz / 8 / 256 = 293Hz (-f overrides).  The
+// pin signal defaults to PB0; if an 8-bit OCR0A signal is present too,
+// each period's duty is also checked against the OCR0A value latched
+// at its start.
+//
+// A period is a glitch if its length is more than a timer tick off
+// nominal, if its high time isn't a whole number of ticks, or if it
+// disagrees with the latched OCR0A.  A ramp step is a period whose
+// duty differs from the one before.
+//
+// Exits 1 if the frequency is more than -e percent (default 1) off or
+// there are glitches, so it can gate a build.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "sim.h"
+#include "vcdread.h"
+
+struct Edge
+{
+  double t;
+  bool high;
+};
+
+struct OcrChange
+{
+  double t;
+  int value;
+};
+
+struct Stats
+{
+  uint64_t n = 0;
+  double sum = 0, squares = 0;
+  double min = INFINITY, max = -INFINITY;
+
+  void
+  add(double x)
+  {
+    n++;
+    sum += x;
+    squares += x * x;
+    min = std::min(min, x);
+    max = std::max(max, x);
+  }
+
+  double
+  mean() const
+  {
+    return n ? sum / n : 0;
+  }
+
+  double
+  stddev() const
+  {
+    double v = n ? squares / n - mean() * mean() : 0;
+    return v > 0 ? sqrt(v) : 0;
+  }
+};
+
+// Reads the signals named pin and ocr from a VCD file.  Returns false
+// if the file can't be read or has no pin signal.
+static bool
+read_vcd(const char* filename, const char* pin, const char* ocr,
+	 std::vector<Edge>& edges, std::vector<OcrChange>& ocrs,
+	 double& end, bool& have_ocr)
+{
+  std::vector<int> widths;
+  std::vector<sim::VcdChange> changes;
+  if (!sim::read_vcd(filename, {pin, ocr}, widths, changes, end)) {
+    return false;
+  }
+  if (widths[0] != 1) {
+    fprintf(stderr, "%s: no 1-bit signal %s\n", filename, pin);
+    return false;
+  }
+  have_ocr = widths[1] == 8;
+
+  for (auto& c : changes) {
+    if (c.signal == 0) {
+      bool high = c.value == 1;
+      if (edges.empty() || edges.back().high != high) {
+	edges.push_back(Edge{c.t, high});
+      }
+    }
+    else if (have_ocr) {
+      ocrs.push_back(OcrChange{c.t, c.value});
+    }
+  }
+  return true;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: vcdpwm [-p pin] [-o ocr] [-f Hz] [-e percent] "
+	  "[-q] file.vcd\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  const char* pin = "PB0";
+  const char* ocr = "OCR0A";
+  double expect_hz = (double)sim::cpu_hz / sim::pwm_period;
+  double tolerance = 1;
+  bool quiet = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "p:o:f:e:q")) != -1) {
+    switch (c) {
+    case 'p':
+      pin = optarg;
+      break;
+    case 'o':
+      ocr = optarg;
+      break;
+    case 'f':
+      expect_hz = atof(optarg);
+      break;
+    case 'e':
+      tolerance = atof(optarg);
+      break;
+    case 'q':
+      quiet = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 1 || expect_hz <= 0) {
+    usage();
+  }
+  const char* filename = argv[optind];
+
+  std::vector<Edge> edges;
+  std::vector<OcrChange> ocrs;
+  double end;
+  bool have_ocr;
+  if (!read_vcd(filename, pin, ocr, edges, ocrs, end, have_ocr)) {
+    return 1;
+  }
+
+  std::vector<double> rises;
+  for (auto& e : edges) {
+    if (e.high) {
+      rises.push_back(e.t);
+    }
+  }
+  if (rises.size() < 3) {
+    fprintf(stderr, "%s: %s has too few edges to measure a period\n",
+	    filename, pin);
+    return 1;
+  }
+
+  // The period is the median rise to rise, which ignores the gaps
+  // while the pin is held high at full duty.
+  std::vector<double> intervals;
+  for (size_t i = 1; i < rises.size(); i++) {
+    intervals.push_back(rises[i] - rises[i - 1]);
+  }
+  std::vector<double> sorted = intervals;
+  std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+		   sorted.end());
+  double period = sorted[sorted.size() / 2];
+  double tick = period / 256;
+  double hz = 1 / period;
+  double error_pct = 100 * (hz - expect_hz) / expect_hz;
+
+  // Walk the periods, measuring each one's duty in timer ticks.
+  uint64_t histogram[16] = {};
+  uint64_t periods = 0;
+  uint64_t glitches = 0;
+  std::vector<double> glitch_times;
+  Stats steps;
+  Stats step_change;
+  uint64_t jumps = 0;
+  int last_duty = -1;
+  double last_step = -1;
+  double last_interval = -1;
+  size_t e = 0;
+  size_t o = 0;
+  int latched = -1;
+
+  auto count = [&](double start, int duty, bool glitch) {
+    periods++;
+    histogram[duty / 16]++;
+    if (glitch) {
+      glitches++;
+      if (glitch_times.size() < 10) {
+	glitch_times.push_back(start);
+      }
+    }
+    if (last_duty >= 0 && duty != last_duty) {
+      if (abs(duty - last_duty) > 1) {
+	jumps++;
+      }
+      if (last_step >= 0) {
+	double interval = start - last_step;
+	steps.add(interval);
+	if (last_interval >= 0) {
+	  step_change.add(fabs(interval - last_interval));
+	}
+	last_interval = interval;
+      }
+      last_step = start;
+    }
+    last_duty = duty;
+  };
+
+  for (size_t i = 0; i + 1 < rises.size(); i++) {
+    double start = rises[i];
+    double next = rises[i + 1];
+    while (e < edges.size() && edges[e].t <= start) {
+      e++;
+    }
+
+    // At full duty the pin stays high across whole periods, so split
+    // the time to the next rise into nominal periods.
+    double fall = e < edges.size() && !edges[e].high ? edges[e].t : next;
+    int whole = std::max(1, (int)floor((next - start) / period + 0.5));
+    for (int n = 0; n < whole; n++) {
+      double s = start + n * period;
+      double len = n + 1 < whole ? period : next - s;
+      while (o < ocrs.size() && ocrs[o].t < s) {
+	latched = ocrs[o].value;
+	o++;
+      }
+
+      double high_ticks = (std::min(fall, s + len) - s) / tick;
+      int duty = (int)floor(high_ticks + 0.5) - 1;
+      duty = std::max(0, std::min(255, duty));
+      bool glitch = high_ticks <= 0 || fabs(len - period) > tick
+	|| fabs(high_ticks - floor(high_ticks + 0.5)) > 0.25
+	|| (have_ocr && latched >= 0 && latched != duty);
+      count(s, duty, glitch);
+    }
+  }
+
+  printf("%s: %s, %llu periods, %.3f s\n", filename, pin,
+	 (unsigned long long)periods, end);
+  printf("frequency        %.2f Hz (expected %.2f Hz, %+.2f%%)\n",
+	 hz, expect_hz, error_pct);
+  printf("glitches         %llu", (unsigned long long)glitches);
+  for (double t : glitch_times) {
+    printf(" %.6f", t);
+  }
+  printf(glitches > glitch_times.size() ? " ...\n" : "\n");
+  if (!have_ocr) {
+    printf("                 (no %s signal to check duty against)\n", ocr);
+  }
+  if (steps.n) {
+    printf("ramp steps       %llu, %llu jumps of more than one count\n",
+	   (unsigned long long)steps.n + 1, (unsigned long long)jumps);
+    printf("step interval    mean %.2f ms, min %.2f ms, max %.2f ms, "
+	   "sd %.2f ms\n",
+	   1000 * steps.mean(), 1000 * steps.min, 1000 * steps.max,
+	   1000 * steps.stddev());
+    printf("step jitter      mean %.2f ms step to step\n",
+	   1000 * step_change.mean());
+  }
+  if (!quiet) {
+    printf("duty histogram (OCR0A):\n");
+    uint64_t most = *std::max_element(histogram, histogram + 16);
+    for (int i = 0; i < 16; i++) {
+      int bar = most ? (int)(50 * histogram[i] / most) : 0;
+      printf("  %3d-%3d %8llu %.*s\n", 16 * i, 16 * i + 15,
+	     (unsigned long long)histogram[i], bar,
+	     "##################################################");
+    }
+  }
+
+  return fabs(error_pct) > tolerance || glitches ? 1 : 0;
+}
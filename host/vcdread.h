@@ -0,0 +1,120 @@
+#ifndef VCDREAD_H
+#define VCDREAD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Reads value changes out of a VCD file, from simavr or VcdWriter.
+// Only what those write is understood: one scope, wires and regs,
+// scalar and binary vector changes.
+
+namespace sim {
+
+struct VcdChange
+{
+  double t;			// Seconds.
+  int signal;			// Index into the names asked for.
+  int value;			// -1 if any bit is x or z.
+};
+
+// Reads the changes to the named signals, in time order.  widths[i]
+// is the width of names[i], or 0 if the file doesn't have it.  end is
+// the last time stamp.  Returns false if the file can't be read.
+inline bool
+read_vcd(const char* filename, const std::vector<std::string>& names,
+	 std::vector<int>& widths, std::vector<VcdChange>& changes,
+	 double& end)
+{
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+
+  widths.assign(names.size(), 0);
+  std::vector<std::string> ids(names.size());
+  double unit = 1e-9;
+  double t = 0;
+  char buf[256];
+  std::string section;
+  std::vector<std::string> decl;
+  bool in_header = true;
+
+  auto change = [&](const std::string& id, int value) {
+    for (size_t i = 0; i < ids.size(); i++) {
+      if (widths[i] && ids[i] == id) {
+	changes.push_back(VcdChange{t, (int)i, value});
+      }
+    }
+  };
+
+  while (fscanf(f, "%255s", buf) == 1) {
+    std::string tok(buf);
+    if (in_header) {
+      if (tok == "$end") {
+	if (section == "$timescale") {
+	  std::string s;
+	  for (auto& d : decl) {
+	    s += d;
+	  }
+	  double mult = atof(s.c_str());
+	  size_t i = s.find_first_not_of("0123456789");
+	  std::string u = i == std::string::npos ? "s" : s.substr(i);
+	  double base = u == "s" ? 1 : u == "ms" ? 1e-3 : u == "us" ? 1e-6
+	    : u == "ns" ? 1e-9 : u == "ps" ? 1e-12 : 1e-15;
+	  unit = mult * base;
+	}
+	else if (section == "$var" && decl.size() >= 4) {
+	  // type width id name
+	  for (size_t i = 0; i < names.size(); i++) {
+	    if (decl[3] == names[i]) {
+	      widths[i] = atoi(decl[1].c_str());
+	      ids[i] = decl[2];
+	    }
+	  }
+	}
+	else if (section == "$enddefinitions") {
+	  in_header = false;
+	}
+	section.clear();
+	decl.clear();
+      }
+      else if (tok[0] == '$') {
+	section = tok;
+      }
+      else {
+	decl.push_back(tok);
+      }
+      continue;
+    }
+
+    if (tok[0] == '#') {
+      t = atof(tok.c_str() + 1) * unit;
+    }
+    else if (tok[0] == 'b' || tok[0] == 'B') {
+      char id[256];
+      if (fscanf(f, "%255s", id) != 1) {
+	break;
+      }
+      int v = strpbrk(tok.c_str(), "xXzZ") ? -1
+	: (int)strtol(tok.c_str() + 1, nullptr, 2);
+      change(id, v);
+    }
+    else if (tok[0] == 'r' || tok[0] == 'R') {
+      fscanf(f, "%255s", buf);
+    }
+    else if (strchr("01xXzZ", tok[0])) {
+      change(tok.substr(1), tok[0] == '1' ? 1 : tok[0] == '0' ? 0 : -1);
+    }
+  }
+  fclose(f);
+  end = t;
+  return true;
+}
+
+} // namespace sim
+
+#endif // VCDREAD_H
@@ -0,0 +1,721 @@
+// Static best and worst case cycle counts from the firmware's
+// disassembly.
+//
+//   wcet [-v] spiro.lst spiro.wcet
+//
+// Reads avr-objdump -S output, builds the control flow graph of main,
+// the functions it calls and the interrupt vectors, and finds every
+// loop.  Each loop needs a bound from the annotation file, which has
+// lines
+//
+//   loop min max name text     loop runs min to max times per entry
+//   loop - - name text         loop never exits
+//   budget name cycles         worst case limit
+//
+// A loop's annotation is the first whose text appears in the source
+// or symbol the listing shows before the loop's header or its
+// back-edge branch, so annotations survive rebuilds.  Bounds count
+// executions of the header, so a while loop that runs its body n times
+// has a bound of n + 1 if the compiler tests at the top.  An unbounded
+// loop in main that never exits is main_loop without an annotation.
+//
+// Prints each function's cycles from entry to ret, and each loop's
+// cycles per iteration and in total, inner loops and calls included.
+// A budget applies to the worst iteration of the loops with that name
+// or the worst case of the function.  Exits 1 if a loop has no bound
+// or a budget is exceeded, so it can gate a build.  -v lists every
+// instruction's loop.
+//
+// Cycle counts are the ATtiny13's (AVRe, 2-byte PC).  Times spent
+// waiting on hardware, like ADC conversions, are in the loop bounds.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "lst.h"
+
+struct Edge
+{
+  uint32_t to;
+  uint64_t best, worst;
+  bool exit;			// ret or reti; to is meaningless.
+};
+
+struct Range
+{
+  uint64_t best = 0, worst = 0;
+};
+
+struct Loop
+{
+  std::string function;
+  uint32_t header;
+  std::set<uint32_t> body;
+  std::vector<uint32_t> latches;
+  int parent = -1;
+  std::string name = "loop";
+  long min = 0, max = 0;	// -1 if it never exits.
+  bool bounded = false;
+  Range iteration;
+  Range total;
+  bool exits = false;
+};
+
+struct Annotation
+{
+  long min, max;
+  std::string name;
+  std::string text;
+  bool used = false;
+};
+
+struct Budget
+{
+  std::string name;
+  uint64_t cycles;
+};
+
+struct Function
+{
+  bool done = false;
+  bool busy = false;
+  bool returns = false;
+  Range cycles;
+};
+
+static sim::Listing listing;
+static std::map<uint32_t, sim::Insn>& code = listing.code;
+static std::map<std::string, uint32_t>& symbols = listing.symbols;
+static std::map<uint32_t, std::string>& names = listing.names;
+static std::vector<Annotation> annotations;
+static std::vector<Budget> budgets;
+static std::vector<Loop> loops;
+static std::map<uint32_t, Function> functions;
+static bool failed = false;
+
+static bool
+read_annotations(const char* filename)
+{
+  FILE* f = fopen(filename, "r");
+  if (!f) {
+    perror(filename);
+    return false;
+  }
+  char line[1024];
+  int lineno = 0;
+  while (fgets(line, sizeof line, f)) {
+    lineno++;
+    std::string s = sim::trim(line);
+    if (s.empty() || s[0] == '#') {
+      continue;
+    }
+    char kind[32], min[32], max[32], name[128];
+    int n;
+    if (sscanf(s.c_str(), "%31s", kind) != 1) {
+      continue;
+    }
+    if (strcmp(kind, "loop") == 0
+	&& sscanf(s.c_str(), "%*s %31s %31s %127s %n", min, max, name,
+		  &n) == 3
+	&& n < (int)s.size()) {
+      Annotation a;
+      a.min = strcmp(min, "-") == 0 ? -1 : atol(min);
+      a.max = strcmp(max, "-") == 0 ? -1 : atol(max);
+      a.name = name;
+      a.text = sim::trim(s.substr(n));
+      if ((a.min < 0) != (a.max < 0) || (a.min >= 0 && a.min < 1)
+	  || a.max < a.min) {
+	fprintf(stderr, "%s:%d: bad bounds\n", filename, lineno);
+	return false;
+      }
+      annotations.push_back(a);
+    }
+    else if (strcmp(kind, "budget") == 0
+	     && sscanf(s.c_str(), "%*s %127s %31s", name, max) == 2) {
+      budgets.push_back(Budget{name, strtoull(max, nullptr, 10)});
+    }
+    else {
+      fprintf(stderr, "%s:%d: expected loop or budget\n", filename, lineno);
+      return false;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// Cycles for the instructions that don't branch.
+static uint64_t
+cycles(const std::string& op)
+{
+  static const std::set<std::string> two = {
+    "adiw", "sbiw", "ld", "ldd", "st", "std", "lds", "sts", "push",
+    "pop", "sbi", "cbi", "rjmp", "ijmp",
+  };
+  if (two.count(op)) {
+    return 2;
+  }
+  if (op == "lpm" || op == "jmp" || op == "rcall" || op == "icall") {
+    return 3;
+  }
+  if (op == "ret" || op == "reti" || op == "call") {
+    return 4;
+  }
+  return 1;
+}
+
+static Range analyze(uint32_t entry);
+
+static std::vector<Edge>
+edges(const sim::Insn& insn)
+{
+  uint32_t next = insn.addr + insn.size;
+  uint64_t c = cycles(insn.op);
+  std::vector<Edge> e;
+
+  switch (sim::flow(insn)) {
+  case sim::flow_next:
+    e.push_back(Edge{next, c, c, false});
+    break;
+  case sim::flow_jump:
+    e.push_back(Edge{(uint32_t)insn.target, c, c, false});
+    break;
+  case sim::flow_branch:
+    e.push_back(Edge{next, 1, 1, false});
+    e.push_back(Edge{(uint32_t)insn.target, 2, 2, false});
+    break;
+  case sim::flow_skip: {
+    uint32_t after = listing.skip(insn);
+    uint64_t skipped = 1 + (after - next) / 2;
+    e.push_back(Edge{next, 1, 1, false});
+    e.push_back(Edge{after, skipped, skipped, false});
+    break;
+  }
+  case sim::flow_call: {
+    Range callee = analyze(insn.target);
+    e.push_back(Edge{next, c + callee.best, c + callee.worst, false});
+    break;
+  }
+  case sim::flow_return:
+    e.push_back(Edge{0, c, c, true});
+    break;
+  case sim::flow_indirect:
+    fprintf(stderr, "%x: can't follow %s\n", insn.addr, insn.op.c_str());
+    failed = true;
+    break;
+  }
+  return e;
+}
+
+// The loop's annotation, going by the source of its back-edge branches
+// and then of its header.  An outer loop often shows the same source
+// as an inner one, so it can't have an annotation an inner loop has.
+static Annotation*
+annotation(const Loop& loop, const std::set<Annotation*>& inner)
+{
+  std::vector<uint32_t> where = loop.latches;
+  where.push_back(loop.header);
+  for (uint32_t addr : where) {
+    for (auto& a : annotations) {
+      if (!inner.count(&a)
+	  && code[addr].text.find(a.text) != std::string::npos) {
+	return &a;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Nodes in a region's graph are instructions by address, inner loops
+// as loop_node(), and these.
+const long out_node = -1;	// Out of the region.
+const long back_node = -2;	// Back to the loop's header.
+
+static long
+loop_node(int l)
+{
+  return -3 - l;
+}
+
+// Best and worst cycles from entry to ret.  Both are zero if it never
+// returns.
+static Range
+analyze(uint32_t entry)
+{
+  Function& fn = functions[entry];
+  if (fn.done) {
+    return fn.cycles;
+  }
+  std::string fname = names.count(entry) ? names[entry] : "?";
+  if (fn.busy) {
+    fprintf(stderr, "%s: recursion\n", fname.c_str());
+    failed = true;
+    return fn.cycles;
+  }
+  fn.busy = true;
+
+  // The function's instructions and edges, calls folded in.
+  std::map<uint32_t, std::vector<Edge>> graph;
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> stack{entry};
+  while (!stack.empty()) {
+    uint32_t a = stack.back();
+    stack.pop_back();
+    if (graph.count(a)) {
+      continue;
+    }
+    auto i = code.find(a);
+    if (i == code.end()) {
+      fprintf(stderr, "%s: flows to %x, which isn't code\n", fname.c_str(), a);
+      failed = true;
+      graph[a];
+      continue;
+    }
+    graph[a] = edges(i->second);
+    order.push_back(a);
+    for (auto& e : graph[a]) {
+      if (!e.exit) {
+	stack.push_back(e.to);
+      }
+    }
+  }
+
+  // Dominators, iteratively.  The graphs are small.
+  std::map<uint32_t, std::set<uint32_t>> preds;
+  for (auto& g : graph) {
+    for (auto& e : g.second) {
+      if (!e.exit) {
+	preds[e.to].insert(g.first);
+      }
+    }
+  }
+  std::set<uint32_t> all;
+  for (auto& g : graph) {
+    all.insert(g.first);
+  }
+  std::map<uint32_t, std::set<uint32_t>> dom;
+  for (uint32_t a : all) {
+    dom[a] = a == entry ? std::set<uint32_t>{entry} : all;
+  }
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (uint32_t a : order) {
+      if (a == entry) {
+	continue;
+      }
+      std::set<uint32_t> d = all;
+      for (uint32_t p : preds[a]) {
+	std::set<uint32_t> x;
+	std::set_intersection(d.begin(), d.end(), dom[p].begin(),
+			      dom[p].end(), std::inserter(x, x.begin()));
+	d.swap(x);
+      }
+      d.insert(a);
+      if (d != dom[a]) {
+	dom[a] = d;
+	changed = true;
+      }
+    }
+  }
+
+  // Natural loops, one per header.
+  std::map<uint32_t, int> by_header;
+  size_t first = loops.size();
+  for (auto& g : graph) {
+    for (auto& e : g.second) {
+      if (e.exit || !dom[g.first].count(e.to)) {
+	continue;
+      }
+      uint32_t h = e.to;
+      if (!by_header.count(h)) {
+	by_header[h] = loops.size();
+	Loop l;
+	l.function = fname;
+	l.header = h;
+	l.body.insert(h);
+	loops.push_back(l);
+      }
+      Loop& l = loops[by_header[h]];
+      l.latches.push_back(g.first);
+      std::vector<uint32_t> work{g.first};
+      while (!work.empty()) {
+	uint32_t a = work.back();
+	work.pop_back();
+	if (l.body.insert(a).second) {
+	  for (uint32_t p : preds[a]) {
+	    work.push_back(p);
+	  }
+	}
+      }
+    }
+  }
+
+  // Nest them, and work innermost first.
+  std::vector<int> mine;
+  for (size_t i = first; i < loops.size(); i++) {
+    mine.push_back(i);
+  }
+  std::sort(mine.begin(), mine.end(), [](int a, int b) {
+    return loops[a].body.size() < loops[b].body.size();
+  });
+  for (size_t i = 0; i < mine.size(); i++) {
+    for (size_t j = i + 1; j < mine.size(); j++) {
+      if (loops[mine[j]].body.count(loops[mine[i]].header)) {
+	loops[mine[i]].parent = mine[j];
+	break;
+      }
+    }
+  }
+
+  // The innermost loop around each instruction.
+  std::map<uint32_t, int> inner;
+  for (int l : mine) {
+    for (uint32_t a : loops[l].body) {
+      if (!inner.count(a)) {
+	inner[a] = l;
+      }
+    }
+  }
+
+  // Longest and shortest paths through a region: the loop's body, or
+  // the function for l = -1, with each inner loop one node costing its
+  // total.  Back edges to the loop's header end an iteration; other
+  // edges out of the region and rets end it for good.
+  auto region = [&](int l, Range& iteration, Range& out, bool& exits,
+		    bool& iterates) {
+    // The node for a: the outermost loop inside l containing it, or
+    // itself.
+    auto rep = [&](uint32_t a) -> long {
+      auto it = inner.find(a);
+      if (it == inner.end()) {
+	return a;
+      }
+      int c = it->second;
+      if (c == l) {
+	return a;
+      }
+      while (loops[c].parent != l) {
+	c = loops[c].parent;
+	if (c < 0) {
+	  return a;
+	}
+      }
+      return loop_node(c);
+    };
+    long start = l < 0 ? rep(entry) : loops[l].header;
+    auto inside = [&](uint32_t a) {
+      return l < 0 || loops[l].body.count(a);
+    };
+
+    std::map<long, std::vector<std::pair<long, Edge>>> succ;
+    std::map<long, int> indegree;
+    for (auto& g : graph) {
+      if (!inside(g.first)) {
+	continue;
+      }
+      long from = rep(g.first);
+      for (auto& e : g.second) {
+	Edge x = e;
+	if (from < 0) {
+	  x.best = x.worst = 0;	// In the inner loop's total.
+	}
+	long to;
+	if (e.exit || !inside(e.to)) {
+	  to = out_node;
+	}
+	else if (l >= 0 && e.to == loops[l].header) {
+	  to = back_node;
+	}
+	else {
+	  to = rep(e.to);
+	  if (to == from && from < 0) {
+	    continue;
+	  }
+	}
+	succ[from].push_back(std::make_pair(to, x));
+	if (to != out_node && to != back_node) {
+	  indegree[to]++;
+	}
+      }
+      indegree[from];
+    }
+
+    std::map<long, Range> at;
+    std::map<long, bool> reached;
+    at[start] = Range();
+    reached[start] = true;
+    std::vector<long> ready;
+    for (auto& d : indegree) {
+      if (d.second == 0) {
+	ready.push_back(d.first);
+      }
+    }
+    iteration = Range();
+    out = Range();
+    exits = iterates = false;
+    size_t visited = 0;
+    auto merge = [](Range& r, bool& seen, uint64_t best, uint64_t worst) {
+      r.best = seen ? std::min(r.best, best) : best;
+      r.worst = seen ? std::max(r.worst, worst) : worst;
+      seen = true;
+    };
+    while (!ready.empty()) {
+      long n = ready.back();
+      ready.pop_back();
+      visited++;
+      Range r = at[n];
+      if (n < 0) {
+	Loop& c = loops[-3 - n];
+	r.best += c.total.best;
+	r.worst += c.total.worst;
+      }
+      for (auto& s : succ[n]) {
+	uint64_t best = r.best + s.second.best;
+	uint64_t worst = r.worst + s.second.worst;
+	if (!reached[n]) {
+	  // Not reachable from the start.
+	}
+	else if (s.first == out_node) {
+	  merge(out, exits, best, worst);
+	}
+	else if (s.first == back_node) {
+	  merge(iteration, iterates, best, worst);
+	}
+	else {
+	  bool seen = reached[s.first];
+	  merge(at[s.first], seen, best, worst);
+	  reached[s.first] = seen;
+	}
+	if (s.first != out_node && s.first != back_node
+	    && --indegree[s.first] == 0) {
+	  ready.push_back(s.first);
+	}
+      }
+    }
+    if (visited != indegree.size()) {
+      fprintf(stderr, "%s: irreducible control flow\n", fname.c_str());
+      failed = true;
+    }
+  };
+
+  std::map<int, Annotation*> taken;
+  for (int l : mine) {
+    Loop& loop = loops[l];
+    std::set<Annotation*> inner;
+    for (int c : mine) {
+      for (int p = loops[c].parent; p >= 0; p = loops[p].parent) {
+	if (p == l && taken.count(c)) {
+	  inner.insert(taken[c]);
+	}
+      }
+    }
+    Annotation* a = annotation(loop, inner);
+    if (a) {
+      taken[l] = a;
+      a->used = true;
+      loop.name = a->name;
+      loop.min = a->min;
+      loop.max = a->max;
+      loop.bounded = true;
+    }
+    bool iterates;
+    region(l, loop.iteration, loop.total, loop.exits, iterates);
+    if (!loop.bounded && !loop.exits && loop.parent < 0
+	&& fname == "main") {
+      loop.name = "main_loop";
+      loop.min = loop.max = -1;
+      loop.bounded = true;
+    }
+    if (!loop.bounded) {
+      fprintf(stderr, "%s: loop at %x has no bound\n", fname.c_str(),
+	      loop.header);
+      failed = true;
+    }
+    else if (loop.max < 0 ? loop.exits : !loop.exits) {
+      fprintf(stderr, "%s: loop %s at %x %s\n", fname.c_str(),
+	      loop.name.c_str(), loop.header,
+	      loop.exits ? "exits" : "never exits");
+      failed = true;
+    }
+    if (loop.bounded && loop.exits) {
+      // Every entry ends with the path out.
+      loop.total.best += (loop.min - 1) * loop.iteration.best;
+      loop.total.worst += (loop.max - 1) * loop.iteration.worst;
+    }
+  }
+
+  Range iteration;
+  bool iterates;
+  region(-1, iteration, fn.cycles, fn.returns, iterates);
+  fn.busy = false;
+  fn.done = true;
+  return fn.cycles;
+}
+
+static std::string
+source(uint32_t addr)
+{
+  // The last line of source before it.
+  std::string text = code[addr].text;
+  std::string last;
+  size_t a = 0;
+  while (a < text.size()) {
+    size_t b = text.find('\n', a);
+    if (b == std::string::npos) {
+      b = text.size();
+    }
+    std::string s = sim::trim(text.substr(a, b - a));
+    if (!s.empty()) {
+      last = s;
+    }
+    a = b + 1;
+  }
+  return last.size() > 40 ? last.substr(0, 37) + "..." : last;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr, "usage: wcet [-v] spiro.lst spiro.wcet\n");
+  exit(2);
+}
+
+int
+main(int argc, char** argv)
+{
+  bool verbose = false;
+
+  int c;
+  while ((c = getopt(argc, argv, "v")) != -1) {
+    switch (c) {
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 2) {
+    usage();
+  }
+  const char* lst = argv[optind];
+  const char* notes = argv[optind + 1];
+  if (!listing.read(lst) || !read_annotations(notes)) {
+    return 1;
+  }
+  if (!symbols.count("main")) {
+    fprintf(stderr, "%s: no main\n", lst);
+    return 1;
+  }
+
+  std::vector<uint32_t> entries{symbols["main"]};
+  for (auto& s : symbols) {
+    if (s.first.compare(0, 9, "__vector_") == 0 && code.count(s.second)) {
+      entries.push_back(s.second);
+    }
+  }
+  for (uint32_t e : entries) {
+    analyze(e);
+  }
+
+  printf("%-24s %10s %10s\n", "function", "best", "worst");
+  for (auto& f : functions) {
+    if (f.second.returns) {
+      printf("%-24s %10llu %10llu\n", names[f.first].c_str(),
+	     (unsigned long long)f.second.cycles.best,
+	     (unsigned long long)f.second.cycles.worst);
+    }
+    else {
+      printf("%-24s %10s %10s\n", names[f.first].c_str(), "-", "-");
+    }
+  }
+
+  printf("\n%-12s %-12s %5s %11s %9s %9s %10s %10s  %s\n", "loop",
+	 "function", "addr", "bound", "iter_best", "iter_wst", "best",
+	 "worst", "source");
+  for (auto& l : loops) {
+    char bound[32];
+    if (!l.bounded) {
+      snprintf(bound, sizeof bound, "?");
+    }
+    else if (l.min < 0) {
+      snprintf(bound, sizeof bound, "-");
+    }
+    else {
+      snprintf(bound, sizeof bound, "%ld-%ld", l.min, l.max);
+    }
+    printf("%-12s %-12s %5x %11s %9llu %9llu ", l.name.c_str(),
+	   l.function.c_str(), l.header, bound,
+	   (unsigned long long)l.iteration.best,
+	   (unsigned long long)l.iteration.worst);
+    if (l.exits) {
+      printf("%10llu %10llu", (unsigned long long)l.total.best,
+	     (unsigned long long)l.total.worst);
+    }
+    else {
+      printf("%10s %10s", "-", "-");
+    }
+    printf("  %s\n", source(l.header).c_str());
+  }
+
+  if (verbose) {
+    printf("\n");
+    for (auto& i : code) {
+      int innermost = -1;
+      for (size_t l = 0; l < loops.size(); l++) {
+	if (loops[l].body.count(i.first)
+	    && (innermost < 0
+		|| loops[l].body.size() < loops[innermost].body.size())) {
+	  innermost = l;
+	}
+      }
+      printf("%5x %-12s %-6s %s\n", i.first,
+	     innermost < 0 ? "" : loops[innermost].name.c_str(),
+	     i.second.op.c_str(), i.second.args.c_str());
+    }
+  }
+
+  for (auto& a : annotations) {
+    if (!a.used) {
+      fprintf(stderr, "%s: loop %s matched nothing\n", notes, a.name.c_str());
+    }
+  }
+
+  for (auto& b : budgets) {
+    bool found = false;
+    uint64_t worst = 0;
+    for (auto& l : loops) {
+      if (l.name == b.name) {
+	found = true;
+	worst = std::max(worst, l.iteration.worst);
+      }
+    }
+    if (!found && symbols.count(b.name)
+	&& functions.count(symbols[b.name])) {
+      found = true;
+      worst = functions[symbols[b.name]].cycles.worst;
+    }
+    if (!found) {
+      fprintf(stderr, "%s: no loop or function %s for its budget\n",
+	      notes, b.name.c_str());
+    }
+    else if (worst > b.cycles) {
+      fprintf(stderr, "%s: %llu cycles, over its budget of %llu\n",
+	      b.name.c_str(), (unsigned long long)worst,
+	      (unsigned long long)b.cycles);
+      failed = true;
+    }
+    else {
+      printf("%s: %llu cycles, budget %llu\n", b.name.c_str(),
+	     (unsigned long long)worst, (unsigned long long)b.cycles);
+    }
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,1052 @@
+#define F_CPU (9.6e6 / 64)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <util/delay_basic.h>
+#include <avr/fuse.h>
+#include <stdint.h>
+
+#include "spiro.h"
+
+/*
+  PB0/OCOA pin 5: motor pwm
+  PB1/OC0B pin 6: host serial line (REMOTE), or motor pwm (SPREAD)
+  PB2/ADC1 pin 7: motor current shunt (SENSE), fan tach (LINEAR), or
+                  VCC divider (SUPPLY)
+  PB3 pin 2: switch
+  PB4/ADC2 pin 3: knob
+*/
+
+// Build with RAMP_ISR to step random ramps from the Timer0 overflow
+// interrupt (spiro::IsrRamp) instead of busy-waiting, or RAMP_NAKED
+// for the same thing hand-written in assembler.  The Makefile's RAMP
+// variable sets these.  Build with FAST_BOOT (make BOOT=fast) to start
+// the kick before the rest of the setup, with a shorter reset delay.
+
+#if defined(RAMP_NAKED)
+
+// The ramp state lives in registers reserved for the whole program so
+// the interrupt needs no prologue: it saves SREG in r9 and touches
+// nothing else.  The Makefile reserves r2-r9 with -ffixed; they're
+// call-saved and libgcc's arithmetic routines don't use them, so
+// nothing we link can clobber them under the interrupt.  The layout is
+// IsrRamp's, with ip in r8 as the busy flag.
+
+register uint8_t ramp_left asm("r2");
+register uint8_t ramp_dp asm("r3");
+register uint8_t ramp_pwm asm("r4");
+register uint8_t ramp_t asm("r5");
+register uint8_t ramp_acc asm("r6");
+register uint8_t ramp_rate asm("r7");
+register int8_t ramp_ip asm("r8");
+
+// 15 cycles including the vector and interrupt response when idle, 23
+// when it steps the output.
+
+ISR(TIM0_OVF_vect, ISR_NAKED)
+{
+  asm volatile(
+    "in   r9, __SREG__\n"
+    "tst  r8\n"		// Ramping?
+    "breq 1f\n"
+    "add  r6, r7\n"		// acc += rate, carry ends a wait.
+    "brcc 1f\n"
+    "dec  r5\n"		// The 256th wait ends the ramp.
+    "brne 2f\n"
+    "clr  r8\n"
+    "rjmp 1f\n"
+  "2:\n"
+    "sub  r2, r3\n"		// left -= dp, a borrow steps.
+    "brcc 1f\n"
+    "add  r4, r8\n"
+    "out  %[ocr], r4\n"
+  "1:\n"
+    "out  __SREG__, r9\n"
+    "reti\n"
+    :: [ocr] "I" (_SFR_IO_ADDR(OCR0A)));
+}
+
+#elif defined(RAMP_ISR)
+
+static spiro::IsrRamp ramp;
+
+#endif
+
+// Build with SPREAD_TRIANGLE or SPREAD_RANDOM (make SPREAD=triangle or
+// SPREAD=random) for spread-spectrum PWM, see spiro::Spread.  That
+// needs OCR0A for TOP, so the motor moves to OC0B on PB1.  The
+// overflow interrupt comes at TOP and sets up the period after next,
+// since the next one's buffers latch at BOTTOM a tick later, before it
+// can get to them.  So set_pwm() takes two periods, up to 7ms, to
+// reach the pin instead of one.
+
+#if defined(SPREAD_TRIANGLE) || defined(SPREAD_RANDOM)
+#define SPREAD
+
+#if defined(RAMP_ISR) || defined(RAMP_NAKED)
+#error "SPREAD owns the overflow interrupt's writes, build it with RAMP=busy"
+#endif
+#if defined(REMOTE) || defined(PROFILE)
+#error "SPREAD puts the motor on PB1"
+#endif
+
+static spiro::Spread spread;
+static volatile uint8_t spread_pwm;
+
+#endif
+
+// The PWM output's compare output mode bit, which a SENSE build
+// clears to cut the motor.
+#if defined(SPREAD)
+const uint8_t pwm_com = _BV(COM0B1);
+#else
+const uint8_t pwm_com = _BV(COM0A1);
+#endif
+
+// Pins with nothing on them, which get pull-ups.
+const uint8_t unused_pins = _BV(PB5)
+#if !defined(SENSE)
+  | _BV(PB2)			// The shunt, or the tach's pull-up.
+#endif
+#if defined(SPREAD)
+  | _BV(PB0)
+#else
+  | _BV(PB1)
+#endif
+  ;
+
+// Build with SLEW set to a rate (make SLEW=32) to limit how fast the
+// output moves to rate sixteenths of a count a PWM period, see
+// spiro::Slew.  set_pwm() only sets the target and the overflow
+// interrupt steps towards it, so that goes for everything that sets
+// the output: manual mode, switch changes, ramps and REMOTE's 'd'.
+// The kick isn't slewed, so it's full power from the start with
+// either boot.  After a SENSE trip the output comes back up from 0.
+
+#if defined(SLEW)
+
+#if defined(RAMP_NAKED)
+#error "SLEW needs the overflow interrupt in C, build it with RAMP=busy or isr"
+#endif
+static_assert(SLEW > 0 && SLEW <= 0xF0, "SLEW is 1 to 240");
+
+static spiro::Slew slew;
+
+static inline void
+slew_output(uint8_t pwm)
+{
+#if defined(SPREAD)
+  spread_pwm = pwm;
+#else
+  OCR0A = pwm;
+#endif
+}
+
+#endif
+
+// Build with SCHED (make SCHED=1) to run the tick scheduler instead
+// of the main loop.  The overflow interrupt only sets ticked, and
+// the ramps are stepped from a task, so RAMP doesn't apply.
+
+#if defined(SCHED)
+
+#if defined(RAMP_ISR) || defined(RAMP_NAKED)
+#error "SCHED steps the ramps itself, build it with RAMP=busy"
+#endif
+
+static volatile bool ticked;
+
+// The knob's readings go through it before REMOTE can replace them,
+// so remote settings are taken exactly.
+static spiro::Knob hysteresis;
+
+// Where task_telemetry leaves the state, for a debugger or simavr.
+volatile spiro::Telemetry telemetry;
+
+#endif
+
+// Build with DYN_CLOCK as well (make SCHED=1 CLOCK=dynamic) to sleep
+// at 75kHz, run the tasks at 4.8MHz, and only wait for conversions at
+// 600kHz.  Timer0 is prescaled by 1, 8 or 64 to stay at 75kHz, so the
+// PWM stays at 293Hz, and the ADC only converts at 600kHz, so its
+// clock stays 75kHz too.  The timer's prescaler keeps counting through
+// a change, so each one can move the next timer tick by up to a tick,
+// 13us, and there are four a period.
+
+#if defined(DYN_CLOCK)
+#if !defined(SCHED)
+#error "DYN_CLOCK needs the sleeps of SCHED"
+#endif
+#if defined(SENSE) || defined(REMOTE)
+#error "DYN_CLOCK would change the clock under SENSE's ADC or REMOTE's bits"
+#endif
+#endif
+
+// Build with SENSE (make SENSE=1) for overcurrent and stall
+// protection from a motor current shunt on ADC1 (PB2), see
+// spiro::Guard.  The ADC runs from its interrupt, one conversion
+// after another, taking turns between the knob and three shunt
+// readings, about 3000 a second.  A trip clears COM0A1, which hands
+// PB0 back to PORTB, which is low, so the motor is off as soon as the
+// interrupt decides.  That's at most two conversions, 350us, after
+// the current goes over the limit, but the shunt only sees it while
+// the output is on, so at low duty it can be most of a PWM period.
+// read_adc() returns the latest knob reading.
+
+const uint8_t admux_knob = _BV(ADLAR) | _BV(MUX1);	// ADC2
+
+#if defined(SENSE)
+
+#if defined(PROFILE)
+#error "SENSE uses PB2, which PROFILE marks on"
+#endif
+
+static spiro::Guard guard;
+static volatile uint8_t knob;
+static uint8_t sense_turn;
+
+const uint8_t admux_shunt = _BV(ADLAR) | _BV(MUX0);	// ADC1
+
+ISR(ADC_vect)
+{
+  uint8_t v = ADCH;
+  if (ADMUX == admux_knob) {
+    knob = v;
+  }
+  else {
+    switch (guard.reading(v)) {
+    case spiro::guard_cut:
+      TCCR0A &= ~pwm_com;
+      break;
+    case spiro::guard_restore:
+#if defined(SLEW)
+      slew.pwm = 0;
+      slew_output(0);
+#endif
+      TCCR0A |= pwm_com;
+      break;
+    }
+  }
+  ADMUX = ++sense_turn & 3 ? admux_shunt : admux_knob;
+  ADCSRA |= _BV(ADSC);
+}
+
+#endif
+
+// Build with SUPPLY (make SUPPLY=1) to compensate the duty for the
+// supply voltage, see spiro::Supply.  The ATtiny13 can't put its
+// bandgap on the ADC's input as the bigger parts can, only use it as
+// the reference, so VCC comes in through a 4:1 divider, say 30k over
+// 10k, on ADC1 (PB2).  Against 1.1V that reads 192 at 3.3V, and full
+// scale is 4.4V.  read_adc() measures it before every 1024th knob
+// reading, about 0.6s apart in manual mode, 2.5s when ramping, and
+// with SCHED 3.5s when ramping and 28s in manual mode, and throws
+// away the first conversion after each change of reference.
+
+#if defined(SUPPLY)
+
+#if defined(SENSE) || defined(LINEAR) || defined(PROFILE)
+#error "SUPPLY's divider is on PB2"
+#endif
+#if defined(RAMP_NAKED)
+#error "SUPPLY scales the ramp interrupt's output, use RAMP=busy or isr"
+#endif
+
+const uint8_t admux_supply = _BV(REFS0) | _BV(ADLAR) | _BV(MUX0);	// ADC1
+const uint8_t supply_nominal = 192;
+
+static spiro::Supply supply = {128};
+static uint16_t supply_turn;
+
+#endif
+
+// Build with REMOTE (make REMOTE=1) to take spiro::Remote commands
+// from a host at 4800 baud, 8N1, on PB1.  The line is shared: it
+// idles high on the pull-up, and the host lets go of it after 'q' for
+// the answer, which is OCR0A, the last knob reading, and the mode
+// with the switch in bit 2.
+//
+// The start bit's falling edge raises the pin change interrupt, which
+// times the rest of the byte itself, acts on it as soon as it has the
+// last data bit and returns in the middle of the stop bit.  So a 'd'
+// in manual mode reaches OCR0A about 30us after the last data bit,
+// before the main loop writes the same value again, although the
+// compare unit still only takes it at the next BOTTOM.  A ramp
+// already under way finishes first, as when the switch changes.
+//
+// Interrupts are held off for the 2ms a byte takes, 8ms with the
+// answer to 'q', so Timer0 ramps run late and a SENSE build misses a
+// conversion or two while the host is talking.
+
+#if defined(REMOTE)
+
+#if defined(PROFILE)
+#error "REMOTE uses PB1, which PROFILE marks on"
+#endif
+
+static spiro::Remote remote;
+#if !defined(SENSE)
+static volatile uint8_t knob;	// The last conversion, for 'q'.
+#endif
+
+// 600kHz / 4800 baud is 125 cycles a bit: 3 a count in
+// bit_delay() and about 8 around it.
+const uint8_t bit_loops = 39;
+
+// The first bit's delay from the start bit's edge is 1.5 bits, to
+// the middle of bit 0, less the 20 cycles or so to get into the
+// interrupt.
+const uint8_t start_loops = 14;
+
+// _delay_loop_1(), written out so spiro.wcet can tell these loops,
+// up to bit_loops round, from the ramp's.
+
+static inline void
+bit_delay(uint8_t count)
+{
+  asm volatile("1: dec %0\n\tbrne 1b"	// bit_delay
+	       : "=r" (count) : "0" (count));
+}
+
+static void
+send(uint8_t b)
+{
+  uint16_t frame = (b | 0x100) << 1;	// Start bit, data, stop bit.
+  DDRB |= _BV(PB1);
+  for (uint8_t i = 10; i; i--) {
+    if (frame & 1) {
+      PORTB |= _BV(PB1);
+    }
+    else {
+      PORTB &= ~_BV(PB1);
+    }
+    frame >>= 1;
+    bit_delay(bit_loops);
+  }
+  DDRB &= ~_BV(PB1);		// PORTB1 ends high, the pull-up.
+}
+
+ISR(PCINT0_vect)
+{
+  if (PINB & _BV(PB1)) {
+    return;			// Not a start bit.
+  }
+  bit_delay(start_loops);
+  uint8_t b = 0;
+  for (uint8_t i = 8; i; i--) {
+    bit_delay(bit_loops);
+    b >>= 1;
+    if (PINB & _BV(PB1)) {
+      b |= 0x80;
+    }
+  }
+
+  uint8_t c = remote.receive(b);
+#if !defined(LINEAR)
+  // A LINEAR build's value needs the table, so the main loop does it.
+  if (c == 'd' && remote.mode == spiro::remote_manual) {
+    static_assert(spiro::DefaultTuning::pwm_min == 0,
+		  "scale_pwm() would be needed here");
+#if defined(SUPPLY)
+    uint8_t duty = supply.multiply(remote.duty);
+#else
+    uint8_t duty = remote.duty;
+#endif
+#if defined(SLEW)
+    slew.target = duty;
+#else
+    OCR0A = duty;
+#endif
+  }
+#endif
+  bit_delay(bit_loops);	// The stop bit.
+  if (c == 'q') {
+    bit_delay(bit_loops);	// Time for the host to let go.
+    send(OCR0A);
+    send(knob);
+    send(remote.mode | (PINB & _BV(PB3)) >> 1);
+  }
+  GIFR = _BV(PCIF);		// Our own edges and the byte's.
+}
+
+#endif
+
+// Build with LINEAR (make LINEAR=1) to scale the knob and random
+// values through a duty table in EEPROM that makes them linear in
+// fan speed, see spiro::linear_pwm() and Spiro::calibrate().  The
+// calibration counts both edges of the fan's tach, open collector on
+// PB2 with the pull-up.  With the motor switched on the low side the
+// tach only means anything while the output is on, so it's only
+// looked at then, which works as long as each tach level lasts longer
+// than a PWM period, up to 4000rpm at 2 pulses a revolution.
+
+#if defined(LINEAR)
+
+#if defined(SENSE) || defined(PROFILE)
+#error "LINEAR's tach is on PB2"
+#endif
+
+#if defined(SPREAD)
+#define PWM_OCR OCR0B
+#else
+#define PWM_OCR OCR0A
+#endif
+
+#endif
+
+// Build with PROFILE to have mark() put the spiro::Mark region on
+// PB1 (bit 0), PB2 (bit 1) and PB5 (bit 2) for host/profile.  PB5 is
+// RESET unless RSTDISBL is programmed, so on a real chip with ISP
+// intact only regions 0-3 can be told apart, but simavr sees all
+// three.  Each mark() and unmark() is a read-modify-write of PORTB,
+// four cycles.
+
+const uint8_t mark_pins = _BV(PB1) | _BV(PB2) | _BV(PB5);
+
+static constexpr uint8_t
+mark_bits(uint8_t m)
+{
+  return ((m & 3) << PB1) | ((m & 4) << (PB5 - 2));
+}
+
+// The hardware policy for spiro::Spiro.  Everything is static and
+// inline so the control logic compiles down to the same register
+// accesses as before.
+
+struct Avr
+{
+#if defined(RAMP_ISR) || defined(RAMP_NAKED)
+  static constexpr bool isr_ramp = true;
+#else
+  static constexpr bool isr_ramp = false;
+#endif
+
+#if defined(FAST_BOOT)
+  static constexpr bool fast_boot = true;
+#else
+  static constexpr bool fast_boot = false;
+#endif
+
+#if defined(SCHED)
+  static constexpr bool sched = true;
+#else
+  static constexpr bool sched = false;
+#endif
+
+#if defined(LINEAR)
+  static constexpr bool linear = true;
+#else
+  static constexpr bool linear = false;
+#endif
+
+  static void
+  init()
+  {
+    // Clock is 9.6MHz.  Prescale by 16 to get 600kHz.  Remember to
+    // change TCCR0B and ADCSRA if this is changed.
+    // Interrupts must be disabled for these two lines.  They are.
+
+    CLKPR = _BV(CLKPCE);	// Enable prescaler to be set.
+    CLKPR = 4;			// Divide by 16 (600kHz).
+
+#if defined(FAST_BOOT)
+    // Start the kick first.  The pin is only set at BOTTOM, so put the
+    // counter at TOP to get there on the first tick instead of a
+    // period later.  OCR0A isn't double buffered until TCCR0A picks
+    // PWM mode, so this write takes effect now.
+
+#if defined(SPREAD)
+    OCR0A = 0xFF;
+    OCR0B = 0xFF;
+#endif
+    kick();
+    TCNT0 = 0xFF;
+    init_pwm();
+    init_pins();
+    init_adc();
+#else
+    init_pins();
+    init_adc();
+    init_pwm();
+#endif
+
+#if defined(PROFILE)
+    DDRB |= mark_pins;		// Marker outputs, mark_main.
+#else
+    // Enable pull-ups on unused/floating input pins.
+
+    PORTB |= unused_pins;
+#endif
+
+#if defined(RAMP_ISR) || defined(RAMP_NAKED) || defined(SCHED) \
+  || defined(SPREAD) || defined(SLEW)
+#if defined(RAMP_NAKED)
+    ramp_ip = 0;		// Registers aren't cleared at reset.
+#endif
+#if defined(SCHED)
+    set_sleep_mode(SLEEP_MODE_IDLE);	// Timer0 keeps running.
+#endif
+    TIMSK0 |= _BV(TOIE0);
+#endif
+#if defined(REMOTE)
+    GIMSK |= _BV(PCIE);		// PB1 is already an input with pull-up.
+    PCMSK |= _BV(PCINT1);
+#endif
+#if defined(RAMP_ISR) || defined(RAMP_NAKED) || defined(SCHED) \
+  || defined(SENSE) || defined(REMOTE) || defined(SPREAD) || defined(SLEW)
+    sei();
+#endif
+#if defined(SENSE)
+    // Until the interrupt's first conversion, the knob, is done,
+    // read_adc() would return 0 and boot() would seed rnd with it.
+    while (!*(volatile uint8_t*)&sense_turn) {
+    }
+#endif
+  }
+
+  static inline void
+  init_pins()
+  {
+    // Switch (PB3) is input (default) with pull-up enabled.
+
+    PORTB |= _BV(PB3);		// Enable pull-up.
+
+    // Knob (PB4/ADC2) is input (default) with pull-up disabled (default)
+    // and digital input buffer disabled.
+
+    DIDR0 |= _BV(ADC2D);	// Disable digital input buffer.
+  }
+
+  static inline void
+  init_adc()
+  {
+    // Select ADC2.
+    ADMUX |= _BV(MUX1);
+    // Left adjust ADC result so it appears in ADCH.
+    ADMUX |= _BV(ADLAR);
+    // Clock prescaler is /8, ADC frequency is 600kHz / 8 = 75kHz
+    // (50-200kHz).
+    ADCSRA = 3;
+    // Enable the ADC.
+    ADCSRA |= _BV(ADEN);
+#if defined(SENSE)
+    // The interrupt takes it from here, starting with the knob.
+    DIDR0 |= _BV(ADC1D);
+    ADCSRA |= _BV(ADIE) | _BV(ADSC);
+#elif defined(FAST_BOOT)
+    // Start the first conversion, 25 ADC clocks instead of 13, to run
+    // during the kick.  read_adc() starts another after it.
+    ADCSRA |= _BV(ADSC);
+#endif
+  }
+
+  static inline void
+  init_pwm()
+  {
+#if defined(SPREAD)
+    // Fast PWM mode, TOP = OCR0A, which starts at 0xFF, on OC0B.
+
+    OCR0A = 0xFF;
+    TCCR0A = _BV(COM0B1) | _BV(WGM01) | _BV(WGM00);
+    TCCR0B |= _BV(WGM02) | _BV(CS01);
+
+    DDRB |= _BV(DDB1);		// Pin 6 (OC0B) is output.
+#else
+    // Fast PWM mode, TOP = 0xFF.
+
+    TCCR0A = 0x83;
+
+    // Select clock = CPU/8 which starts the timer.  The PWM is
+    // 600kHz/8/256 = 293Hz.
+    // Spec says 21kHz - 28kHz, nominal 25kHz.
+
+    TCCR0B |= _BV(CS01);
+
+    DDRB |= _BV(DDB0);		// Pin 4 (OC0A) is output.
+#endif
+  }
+
+  static uint8_t
+  read_adc()
+  {
+#if defined(SENSE)
+    uint8_t v = knob;
+#else
+#if defined(DYN_CLOCK)
+    // Only convert at 600kHz, which is how it starts, and stays for
+    // boot().
+    uint8_t fast = CLKPR != 4;
+    if (fast) {
+      clock_normal();
+    }
+#endif
+#if defined(SUPPLY)
+    if ((supply_turn++ & 1023) == 0) {
+      read_supply();
+    }
+#endif
+    uint8_t v = convert();
+#if defined(DYN_CLOCK)
+    if (fast) {
+      clock_fast();
+    }
+#endif
+#endif
+#if defined(SCHED)
+    v = hysteresis.reading(v);
+#endif
+#if defined(REMOTE)
+#if !defined(SENSE)
+    knob = v;
+#endif
+    asm volatile("" ::: "memory");	// The interrupt changes remote.
+    v = remote.knob(v);
+#endif
+    return v;
+  }
+
+  static inline uint8_t
+  convert()
+  {
+    ADCSRA |= _BV(ADSC);
+    loop_until_bit_is_clear(ADCSRA, ADSC);
+    return ADCH;
+  }
+
+#if defined(SUPPLY)
+
+  static void
+  read_supply()
+  {
+    ADMUX = admux_supply;
+    convert();
+    uint8_t v = convert();
+    ADMUX = admux_knob;
+    convert();
+#if defined(SCHED)
+    // Its manual mode only writes the PWM when the knob moves.
+    uint8_t was = supply.out;
+    supply.reading(v, supply_nominal);
+    if (supply.out != was) {
+      set_pwm(supply.in);
+    }
+#else
+    supply.reading(v, supply_nominal);
+#endif
+  }
+
+#endif
+
+  static inline void
+  set_pwm(uint8_t pwm)
+  {
+#if defined(SUPPLY)
+    pwm = supply.scale(pwm);
+#endif
+#if defined(SLEW)
+    *(volatile uint8_t*)&slew.target = pwm;
+#elif defined(SPREAD)
+    spread_pwm = pwm;
+#else
+    OCR0A = pwm;
+#endif
+  }
+
+  // Full power, past SUPPLY and SLEW.  The slew target goes first, so
+  // an overflow in between only steps towards it.
+  static inline void
+  kick()
+  {
+#if defined(SLEW)
+    *(volatile uint8_t*)&slew.target = 0xFF;
+    *(volatile uint8_t*)&slew.pwm = 0xFF;
+#endif
+#if defined(SPREAD)
+    spread_pwm = 0xFF;
+#else
+    OCR0A = 0xFF;
+#endif
+  }
+
+  static inline bool
+  switch_on()
+  {
+    bool on = (PINB & _BV(PB3)) != 0;
+#if defined(REMOTE)
+    asm volatile("" ::: "memory");
+    on = remote.switch_on(on);
+#endif
+    return on;
+  }
+
+  static inline void
+  delay_loop_1(uint8_t count)
+  {
+    _delay_loop_1(count);
+  }
+
+  // _delay_ms() needs a compile-time constant, which it only sees if
+  // this is inlined.
+  static inline void __attribute__((always_inline))
+  delay_ms(double ms)
+  {
+    _delay_ms(ms);
+  }
+
+#if defined(PROFILE)
+
+  static inline uint8_t
+  mark(uint8_t m)
+  {
+    uint8_t saved = PORTB;
+    PORTB = (saved & ~mark_pins) | mark_bits(m);
+    return saved & mark_pins;
+  }
+
+  static inline void
+  unmark(uint8_t saved)
+  {
+    PORTB = (PORTB & ~mark_pins) | saved;
+  }
+
+#else
+
+  static inline uint8_t
+  mark(uint8_t)
+  {
+    return 0;
+  }
+
+  static inline void
+  unmark(uint8_t)
+  {
+  }
+
+#endif
+
+#if defined(LINEAR)
+
+  static inline uint8_t
+  duty_table(uint8_t k)
+  {
+    loop_until_bit_is_clear(EECR, EEPE);
+    EEARL = k;
+    EECR |= _BV(EERE);
+    return EEDR;
+  }
+
+  // Erase and write, 3.4ms, which the next access waits out.
+  // Interrupts are off for EEMPE's four cycle window.
+
+  static void
+  put_duty(uint8_t k, uint8_t d)
+  {
+    loop_until_bit_is_clear(EECR, EEPE);
+    EECR = 0;
+    EEARL = k;
+    EEDR = d;
+    uint8_t sreg = SREG;
+    cli();
+    EECR |= _BV(EEMPE);
+    EECR |= _BV(EEPE);
+    SREG = sreg;
+  }
+
+  // Counts overflows by TCNT0 going backwards, which works whether
+  // or not an interrupt takes TOV0.  The loop is about 15 cycles, two
+  // timer ticks.
+
+  static uint16_t
+  tach(uint8_t periods)
+  {
+    uint16_t edges = 0;
+    uint8_t level = PINB & _BV(PB2);
+    uint8_t was = TCNT0;
+    do {
+      uint8_t now = TCNT0;
+      if (now <= PWM_OCR) {
+	uint8_t l = PINB & _BV(PB2);
+	if (l != level) {
+	  level = l;
+	  edges++;
+	}
+      }
+      if (now < was) {
+	periods--;
+      }
+      was = now;
+    } while (periods);
+    return edges;
+  }
+
+#else
+
+  static inline uint8_t
+  duty_table(uint8_t)
+  {
+    return 0xFF;
+  }
+
+  static inline void
+  put_duty(uint8_t, uint8_t)
+  {
+  }
+
+  static inline uint16_t
+  tach(uint8_t)
+  {
+    return 0;
+  }
+
+#endif
+
+#if defined(DYN_CLOCK)
+
+  // Interrupts are off for CLKPR's four cycle window, and so that
+  // nothing runs between the clock and the timer's prescaler changing.
+
+  static inline void
+  set_clock(uint8_t clkpr, uint8_t cs)
+  {
+    cli();
+    CLKPR = _BV(CLKPCE);
+    CLKPR = clkpr;
+    TCCR0B = (TCCR0B & ~(_BV(CS02) | _BV(CS01) | _BV(CS00))) | cs;
+    sei();
+  }
+
+  static inline void
+  clock_slow()
+  {
+    set_clock(7, _BV(CS00));			// 75kHz, /1.
+  }
+
+  static inline void
+  clock_normal()
+  {
+    set_clock(4, _BV(CS01));			// 600kHz, /8.
+  }
+
+  static inline void
+  clock_fast()
+  {
+    set_clock(1, _BV(CS01) | _BV(CS00));	// 4.8MHz, /64.
+  }
+
+#endif
+
+#if defined(SCHED)
+
+  // Interrupts are off from the test to the sleep, since sei only
+  // takes effect after the next instruction, so the overflow can't
+  // come in between and leave us asleep for a whole period.
+
+  static inline void
+  sleep_tick()
+  {
+#if defined(DYN_CLOCK)
+    clock_slow();		// The interrupt runs at 75kHz too.
+#endif
+    cli();
+    while (!ticked) {
+      sleep_enable();
+      sei();
+      sleep_cpu();
+      sleep_disable();
+      cli();
+    }
+    ticked = false;
+    sei();
+#if defined(DYN_CLOCK)
+    clock_fast();
+#endif
+  }
+
+  static inline void
+  telemetry(const spiro::Telemetry& t)
+  {
+    ::telemetry.pwm = t.pwm;
+    ::telemetry.adc = t.adc;
+    ::telemetry.on = t.on;
+  }
+
+  static inline void
+  task(uint8_t)
+  {
+  }
+
+#endif
+
+#if defined(RAMP_NAKED)
+
+  // The interrupt only looks at the rest once r8 is set, so that goes
+  // last, and changes the registers behind the compiler's back, so
+  // reads go through asm.  The loads are one asm statement, as the
+  // compiler could otherwise order stores to register variables after
+  // it.
+
+  static inline void
+  start_ramp(const spiro::Line& line, uint8_t rate)
+  {
+    asm volatile(
+      "mov  r2, %[left]\n"
+      "mov  r3, %[dp]\n"
+      "mov  r4, %[pwm]\n"
+      "clr  r5\n"		// t, 256 waits.
+      "clr  r6\n"		// acc.
+      "mov  r7, %[rate]\n"
+      "mov  r8, %[ip]\n"
+      :: [left] "r" (line.left), [dp] "r" (line.dp), [pwm] "r" (line.pwm),
+	 [rate] "r" (rate), [ip] "r" (line.ip));
+  }
+
+  static inline bool
+  ramping()
+  {
+    uint8_t ip;
+    asm volatile("mov %0, r8" : "=r" (ip));
+    return ip != 0;
+  }
+
+  static inline void
+  set_ramp_rate(uint8_t rate)
+  {
+    asm volatile("mov r7, %0" :: "r" (rate));
+  }
+
+  static inline uint8_t
+  ramp_pwm()
+  {
+    uint8_t pwm;
+    asm volatile("mov %0, r4" : "=r" (pwm));
+    return pwm;
+  }
+
+#elif defined(RAMP_ISR)
+
+  // IsrRamp::start() orders the handoff; the other reads go through
+  // volatile since the interrupt changes them.
+
+  static inline void
+  start_ramp(const spiro::Line& line, uint8_t rate)
+  {
+    ramp.start(line, rate);
+  }
+
+  static inline bool
+  ramping()
+  {
+    return ramp.busy();
+  }
+
+  static inline void
+  set_ramp_rate(uint8_t rate)
+  {
+    *(volatile uint8_t*)&ramp.rate = rate;
+  }
+
+  static inline uint8_t
+  ramp_pwm()
+  {
+    return *(volatile uint8_t*)&ramp.line.pwm;
+  }
+
+#endif
+};
+
+#if defined(RAMP_ISR)
+
+// Defined after Avr so it can mark itself.
+
+ISR(TIM0_OVF_vect)
+{
+  Avr avr;
+  spiro::Marker<Avr> m(avr, spiro::mark_isr);
+  if (ramp.tick()) {
+#if defined(SUPPLY)
+    uint8_t pwm = supply.multiply(ramp.line.pwm);
+#else
+    uint8_t pwm = ramp.line.pwm;
+#endif
+#if defined(SLEW)
+    slew.target = pwm;
+#else
+    OCR0A = pwm;
+#endif
+  }
+#if defined(SLEW)
+  if (slew.tick(SLEW)) {
+    OCR0A = slew.pwm;
+  }
+#endif
+}
+
+#elif defined(SCHED) || defined(SPREAD) || defined(SLEW)
+
+ISR(TIM0_OVF_vect)
+{
+  Avr avr;
+  spiro::Marker<Avr> m(avr, spiro::mark_isr);
+#if defined(SLEW)
+  if (slew.tick(SLEW)) {
+    slew_output(slew.pwm);
+  }
+#endif
+#if defined(SPREAD)
+#if defined(SPREAD_TRIANGLE)
+  uint8_t top = spread.triangle();
+#else
+  uint8_t top = spread.random();
+#endif
+  OCR0A = top;
+  OCR0B = spiro::spread_ocr(spread_pwm, top);
+#endif
+#if defined(SCHED)
+  ticked = true;
+#endif
+}
+
+#endif
+
+int
+main(void)
+{
+  Avr avr;
+  spiro::Spiro<Avr>(avr).run();
+}
+
+FUSES = {
+  // Might want to set BOD level.
+#if defined(FAST_BOOT)
+  // SUT = 01: 14CK + 4ms reset delay instead of the default's 64ms,
+  // which is for slowly rising power.  SUT = 00 drops the 4ms too
+  // but is only meant for use with brown-out detection.
+  .low = FUSE_SPIEN & FUSE_CKDIV8 & FUSE_SUT1 & FUSE_CKSEL0,
+#else
+  .low = LFUSE_DEFAULT,
+#endif
+  .high = HFUSE_DEFAULT,
+};
+
+/*
+x[n+1] = (x[n]*a + b) mod m
+If b is nonzero, the maximum possible period m
+is obtained if and only if:
+- Integers m and b are relatively prime, that is, have no common
+factors other than 1.
+- Every prime number that is a factor of m is also a factor of a-1.
+- If integer m is a multiple of 4, a-1 should be a  multiple of 4.
+- Notice that all of these conditions are met if m=2^k, a = 4c + 1,
+and b is odd. Here, c, b, and k are positive integers.
+*/
+
+/*
+TMR2 counts at Fosc/4, and may be further reduced by the prescaler.
+The period is set by PR2.  The pulse width is a fraction of this period.
+With Fosc = 250KHz, clock is 62.5KHz
+With PR2 = 0xFF this gives a period 256 clocks = 4ms (244Hz) which
+may be ok.  For testing with a flashing LED, using prescalar of 1:64
+gives 3.8Hz.  1:16 is 15.25Hz, 1:4 is 61 Hz, 1:1 is 244Hz.
+*/
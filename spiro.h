@@ -0,0 +1,1166 @@
+#ifndef SPIRO_H
+#define SPIRO_H
+
+#include <stdint.h>
+
+// The control logic, independent of the hardware it runs on.  Spiro
+// is parameterized on a hardware policy which supplies:
+//
+//   void init()                 one-time clock/port/ADC/timer setup
+//   uint8_t read_adc()          one knob conversion, 0 -> 255, and
+//                               with sched through a Knob
+//   void set_pwm(uint8_t)       write the motor PWM compare value
+//   void kick()                 full power now, see Spiro::boot()
+//   bool switch_on()            true when the mode switch is on
+//   void delay_loop_1(uint8_t)  _delay_loop_1() semantics
+//   void delay_ms(double)       _delay_ms() semantics
+//   static bool isr_ramp        ramp from the Timer0 interrupt, see
+//                               IsrRamp and Spiro::ramp()
+//   static bool fast_boot       init() starts the PWM at full power
+//                               and a conversion, see Spiro::boot()
+//   static bool sched           run the tick scheduler, see
+//                               Spiro::loop()
+//   uint8_t mark(uint8_t)       enter a profiling region, see Mark
+//   void unmark(uint8_t)        leave it, given what mark() returned
+//   bool linear                 scale through the duty table, see
+//                               Spiro::scale() and Spiro::calibrate()
+//   uint8_t duty_table(uint8_t) read an entry of it
+//   void put_duty(uint8_t k, uint8_t d)  write one
+//   uint16_t tach(uint8_t n)    tach edges over n Timer0 overflows
+//
+// On the AVR these are static inline functions on an empty struct so
+// everything inlines down to the register accesses.  On the host they
+// drive a simulation.
+//
+// The tuning parameters come from a second policy.  DefaultTuning
+// holds them as static constants so the firmware compiles them in;
+// the host can pass a struct with ordinary members instead.
+
+namespace spiro {
+
+struct DefaultTuning
+{
+  // If we make the PWM width too low the motor will stop.  So we
+  // scale the values 0 -> 255 to pwm_min -> 255.  The average voltage
+  // from the PWM is equal to the ADC voltage since they're both linear
+  // from 0 to 3.3V.  pwm_min corresponds to 0.8V which makes sense
+  // since the motor is spec'd to run down to 1V.  That's only while
+  // the supply is 3.3V; a SUPPLY build scales the duty to keep the
+  // mean voltage what it would be then.
+  static constexpr uint8_t pwm_min = 0;
+
+  // Full power for this long at startup to make sure the motor runs.
+  static constexpr uint16_t kick_ms = 250;
+
+  // Each ramp step waits while counting ramp_counter down by
+  // adc + ramp_bias, calling _delay_loop_1(ramp_delay) each time.
+  static constexpr int16_t ramp_counter = 0x2000;
+  static constexpr int16_t ramp_bias = 10;
+  static constexpr uint8_t ramp_delay = 6;
+
+  // rnd = rnd * (2^lcg_shift + 1) + lcg_inc.  See the note on the
+  // period at the end of spiro.cc.
+  static constexpr uint8_t lcg_shift = 2;
+  static constexpr uint16_t lcg_inc = 0x3333;
+
+  // A LINEAR build's calibration steps the duty by calibrate_step
+  // and counts the tach over tach_gate PWM periods, 0.87s.  It takes
+  // up to settle_gates of them for the fan to settle at each duty.
+  static constexpr uint8_t calibrate_step = 4;
+  static constexpr uint8_t tach_gate = 255;
+  static constexpr uint8_t settle_gates = 10;
+
+  // The tick scheduler reads the knob every knob_period ticks in
+  // manual mode, 27ms, and only every tick while ramping.
+  static constexpr uint8_t knob_period = 8;
+};
+
+// Scale 0 -> 255 to pwm_min -> 255
+static inline uint8_t
+scale_pwm(uint8_t in, uint8_t pwm_min)
+{
+  return (uint8_t)(((uint16_t)(255 - pwm_min) * in + 127) / 255) + pwm_min;
+}
+
+// The fan's speed isn't linear in the duty, so a LINEAR build scales
+// through a table of duty_entries duties instead, calibrated so that
+// entry k runs the fan k / duty_entries of the way from its speed at
+// pwm_min to full speed.  So equal knob steps and evenly spread
+// random values are equal speed steps.  The input's top 6 bits pick
+// the entry, and the bottom 2 interpolate towards the next, or 0xFF
+// past the end; lo and hi are the two.
+const uint8_t duty_entries = 64;
+
+static inline uint8_t
+linear_pwm(uint8_t in, uint8_t lo, uint8_t hi)
+{
+  uint8_t d = hi - lo;
+  uint8_t step = 0;
+  if (in & 1) {
+    step += d >> 2;
+  }
+  if (in & 2) {
+    step += d >> 1;
+  }
+  return lo + step;
+}
+
+// Builds the table from a sweep of the fan's speed, as tach counts,
+// up from pwm_min to 0xFF, given lo and hi, the counts at each end.
+// Each time a sweep point's count reaches an entry's target, the
+// entry's duty is interpolated between that point and the last one.
+// The speed should rise with the duty; a point that's slower than
+// the last is interpolated from as if it weren't, which keeps the
+// table in order.  The products stay in 16 bits as long as the counts
+// stay under 1024, 17000rpm with a 0.87s gate.
+
+struct Linearizer
+{
+  uint16_t lo;
+  uint16_t span;		// hi - lo, or 0 if the fan didn't speed up.
+  uint8_t k;			// The next entry.
+  uint8_t d0;			// The last point.
+  uint16_t c0;
+
+  void
+  start(uint8_t pwm_min, uint16_t lo, uint16_t hi)
+  {
+    this->lo = lo;
+    span = hi > lo ? hi - lo : 0;
+    k = 0;
+    d0 = pwm_min;
+    c0 = lo;
+  }
+
+  uint16_t
+  target() const
+  {
+    return lo + span * k / duty_entries;
+  }
+
+  // Whether the point (d, c) reaches entry k, and if so its duty,
+  // after which k moves on.  Call until it returns false, then
+  // next().
+  bool
+  entry(uint8_t d, uint16_t c, uint8_t& duty)
+  {
+    if (k == duty_entries || target() > c) {
+      return false;
+    }
+    duty = c > c0 ? d0 + (uint16_t)(d - d0) * (target() - c0) / (c - c0) : d;
+    k++;
+    return true;
+  }
+
+  void
+  next(uint8_t d, uint16_t c)
+  {
+    d0 = d;
+    if (c > c0) {
+      c0 = c;
+    }
+  }
+};
+
+// Bresenham's line from pwm towards a target over a fixed 256 time
+// steps, so every ramp takes the same number of steps whatever its
+// height.
+//
+// It's done in 8 bits so it stays in single registers.  With dp =
+// |to - pwm|, pwm steps on time step k when floor((k * dp + 128) / 256)
+// goes up, which is dp times in 256 time steps.  Here left counts
+// down from 128 by dp each time step, and each borrow, which adds 256
+// back, is a step.
+//
+// The original ramp divided by 255 instead, so a ramp of more than 127
+// counts took one step past its target, and one to 0 or 0xFF from
+// that far away wrapped round to the other end for its last step.
+
+struct Line
+{
+  uint8_t pwm;
+  uint8_t dp;
+  uint8_t left;
+  int8_t ip;
+
+  void
+  start(uint8_t from, uint8_t to)
+  {
+    pwm = from;
+    if (to >= from) {
+      dp = to - from;
+      ip = 1;
+    }
+    else {
+      dp = from - to;
+      ip = -1;
+    }
+    left = 128;
+  }
+
+  // One time step.  Returns true if pwm changed.
+  bool
+  step()
+  {
+    uint8_t old = left;
+    left -= dp;
+    if (left > old) {
+      pwm += ip;
+      return true;
+    }
+    return false;
+  }
+};
+
+// Sharing state between an interrupt and the main loop without
+// turning interrupts off.  A byte is read or written in one
+// instruction, but anything longer can be torn by an interrupt in the
+// middle, and cli() ... SREG = sreg around it would hold off the PWM
+// interrupts for as long as it takes, jittering them.  These rely on
+// an interrupt running to completion before the main loop goes on,
+// so only one side ever needs to look again.  The cycle figures are
+// counted by hand from the loads, stores and tests each does, two for
+// an lds or sts; none has been measured on the chip or checked against
+// a listing.  For comparison the cli() version of a 16-bit read is 7
+// cycles with 5 of them held off.  IsrRamp::start() hands over several
+// bytes the same way Mailbox::put() does.
+
+// Keeps the compiler from moving loads and stores across it.
+inline void
+barrier()
+{
+  asm volatile("" ::: "memory");
+}
+
+// A value the interrupt writes and the main loop reads.  The reader
+// goes again if seq moved under it, which an interrupt in the middle
+// of the copy would do.  For a uint16_t, write() is 9 cycles and
+// read() 10, plus 11 each time it goes again.
+template<typename T>
+struct Snapshot
+{
+  T value;
+  volatile uint8_t seq;
+
+  // In the interrupt.
+  void
+  write(const T& v)
+  {
+    value = v;
+    barrier();
+    seq = seq + 1;
+  }
+
+  T
+  read() const
+  {
+    uint8_t s;
+    T v;
+    do {
+      s = seq;
+      barrier();
+      v = value;
+      barrier();
+    } while (s != seq);
+    return v;
+  }
+};
+
+// A setpoint the main loop writes and the interrupt reads.  write()
+// fills the buffer the interrupt isn't using and then flips front, so
+// the interrupt always sees a whole one.  For a uint16_t, write() is
+// about 16 cycles and read() 11.
+template<typename T>
+struct Setpoint
+{
+  T buf[2];
+  volatile uint8_t front;
+
+  void
+  write(const T& v)
+  {
+    uint8_t b = front ^ 1;
+    buf[b] = v;
+    barrier();
+    front = b;
+  }
+
+  // In the interrupt.
+  const T&
+  read() const
+  {
+    return buf[front];
+  }
+};
+
+// One byte handed from one side to the other, which the taker has to
+// take before the next can be put.  Either side can be the
+// interrupt.  put() and take() are about 9 cycles each.
+struct Mailbox
+{
+  uint8_t value;
+  volatile bool full;
+
+  // Returns false, and drops b, if the last one hasn't been taken.
+  bool
+  put(uint8_t b)
+  {
+    if (full) {
+      return false;
+    }
+    value = b;
+    barrier();
+    full = true;
+    return true;
+  }
+
+  bool
+  take(uint8_t& b)
+  {
+    if (!full) {
+      return false;
+    }
+    b = value;
+    barrier();
+    full = false;
+    return true;
+  }
+};
+
+// A ramp stepped from the Timer0 overflow interrupt instead of a busy
+// wait, for hardware policies with isr_ramp set.  The main loop does
+// the first time step and keeps rate up to date from the knob; each
+// overflow adds rate to acc and each carry ends a wait, after which
+// the interrupt does the next time step.  The 256th carry ends the
+// ramp, which clears line.ip, so ip doubles as the busy flag.  It is
+// also Mailbox's full flag for handing over the rest: the interrupt
+// doesn't touch them while ip is clear, so start() writes them first
+// and ip last, and the main loop reads it back through volatile.
+//
+// That is at most one time step per PWM period, which is as fast as
+// the output can change anyway since OCR0A only latches at BOTTOM.
+// This is the C version; spiro.cc has the same thing in assembler on
+// reserved registers.
+
+struct IsrRamp
+{
+  Line line;
+  uint8_t t;
+  uint8_t acc;
+  uint8_t rate;
+
+  // Only while !busy().
+  void
+  start(const Line& l, uint8_t r)
+  {
+    line.left = l.left;
+    line.dp = l.dp;
+    line.pwm = l.pwm;
+    t = 0;
+    acc = 0;
+    rate = r;
+    barrier();
+    *(volatile int8_t*)&line.ip = l.ip;
+  }
+
+  bool
+  busy() const
+  {
+    return *(const volatile int8_t*)&line.ip != 0;
+  }
+
+  // In the interrupt.  Returns true if line.pwm changed.
+  bool
+  tick()
+  {
+    if (!line.ip) {
+      return false;
+    }
+    uint8_t old = acc;
+    acc += rate;
+    if (acc >= old) {
+      return false;
+    }
+    if (--t == 0) {
+      line.ip = 0;
+      return false;
+    }
+    return line.step();
+  }
+};
+
+// The knob to IsrRamp::rate, roughly matching the time step of the
+// busy-wait ramp with the default tuning until it's capped at one
+// step per period.
+static inline uint8_t
+isr_ramp_rate(uint8_t adc)
+{
+  return adc >= (255 - 28) / 3 ? 255 : 28 + 3 * adc;
+}
+
+// Overcurrent and stall protection, for hardware with a motor
+// current shunt on an ADC channel.  Each shunt reading, 8 bits of
+// VCC, goes to reading(), which says when to cut the PWM output and
+// when to restore it.
+//
+// The shunt only carries the current while the output is on.  So a
+// single reading over short_limit is a fault, but a stall is the
+// mean of a window of readings, which is the mean motor current,
+// staying over stall_limit for stall_windows windows.  That's longer
+// than a kick takes to spin the motor up, and a stall at low duty
+// draws too little to need cutting.  After a trip the output is
+// retried after backoff readings, doubling each time it trips again
+// up to max_level times, until it has run clean_after readings.
+//
+// The limits are for a 1 ohm shunt at 3.3V, 12.9mA a count, and
+// about 3000 readings a second.
+
+enum GuardAction : uint8_t
+{
+  guard_none,
+  guard_cut,
+  guard_restore,
+};
+
+struct Guard
+{
+  static constexpr uint8_t short_limit = 40;	// 520mA
+  static constexpr uint8_t stall_limit = 24;	// 310mA
+  static constexpr uint8_t window = 16;
+  static constexpr uint8_t stall_windows = 100;	// 0.5s
+  static constexpr uint16_t backoff = 320;	// 0.1s
+  static constexpr uint8_t max_level = 5;
+  static constexpr uint16_t clean_after = 3200;	// 1s
+
+  uint16_t sum;			// This window's readings so far.
+  uint8_t n;			// How many.
+  uint8_t over;			// Windows in a row over stall_limit.
+  uint8_t level;		// Trips since it last ran clean.
+  uint16_t left;		// Readings until the retry while cut, or
+				// until level is cleared.
+  bool cut;
+
+  uint8_t
+  reading(uint8_t shunt)
+  {
+    if (cut) {
+      if (--left == 0) {
+	cut = false;
+	left = clean_after;
+	return guard_restore;
+      }
+      return guard_none;
+    }
+    if (left && --left == 0) {
+      level = 0;
+    }
+    if (shunt > short_limit) {
+      return trip();
+    }
+    sum += shunt;
+    if (++n == window) {
+      over = sum > (uint16_t)stall_limit * window ? over + 1 : 0;
+      sum = 0;
+      n = 0;
+      if (over == stall_windows) {
+	return trip();
+      }
+    }
+    return guard_none;
+  }
+
+private:
+  uint8_t
+  trip()
+  {
+    cut = true;
+    sum = 0;
+    n = 0;
+    over = 0;
+    left = backoff << level;
+    if (level < max_level) {
+      level++;
+    }
+    return guard_cut;
+  }
+};
+
+// Spread-spectrum PWM, for hardware that can give Timer0 a TOP of
+// its own each period.  Moving TOP between 0xFF and 0xFF - depth
+// spreads the switching tone and its harmonics over 293Hz to 330Hz
+// and multiples instead of piling them onto 293Hz.  TOP stays put for
+// dwell periods at a time and either sweeps down and back up, over
+// 256 periods, or hops at random.  Changing it every period spreads
+// the fundamental less, since the periods' jitter averages out.
+//
+// The compare value for a period comes from spread_ocr(), which
+// scales the PWM value to that period's TOP so the duty stays what it
+// would be at 0xFF.
+
+struct Spread
+{
+  static constexpr uint8_t depth = 31;
+  static constexpr uint8_t dwell = 4;
+
+  uint8_t t;			// Periods, mod 256.
+  uint8_t r;			// random()'s LCG, which has a full period.
+
+  uint8_t
+  triangle()
+  {
+    uint8_t s = ++t / dwell & 63;
+    return 0xFF - (s & 32 ? 63 - s : s);
+  }
+
+  uint8_t
+  random()
+  {
+    if (++t % dwell == 0) {
+      r = (r << 2) + r + 1;
+    }
+    return 0xFF - (r >> 3);
+  }
+};
+
+// The pin is high for ocr + 1 of top + 1 ticks, and should be for
+// (pwm + 1) / 256 of them, rounded.  top + 1 is 256 - k with k at
+// most depth, so that's (pwm + 1) * 256 less five shift-and-adds of
+// (pwm + 1) * k, with no multiply.  pwm 0xFF gives top, always high.
+static inline uint8_t
+spread_ocr(uint8_t pwm, uint8_t top)
+{
+  uint8_t k = 0xFF - top;
+  uint16_t p = pwm + 1;
+  uint16_t high = p << 8;
+  for (uint8_t b = 0; b < 5; b++) {
+    if (k & 1 << b) {
+      high -= p << b;
+    }
+  }
+  return (uint8_t)((high + 128) >> 8) - 1;
+}
+
+// A slew rate limit on the PWM output, for hardware that can step it
+// once a PWM period.  pwm follows target by rate sixteenths of a count
+// a period, carried in acc, so rate 16 takes 256 periods, 0.87s, from
+// 0 to 0xFF, and rate 0xF0 takes 17.  rate is at most 0xF0 so acc
+// can't overflow.
+
+struct Slew
+{
+  uint8_t pwm;			// What's output.
+  uint8_t target;
+  uint8_t acc;
+
+  // Returns true if pwm changed.
+  bool
+  tick(uint8_t rate)
+  {
+    if (pwm == target) {
+      acc = 0;
+      return false;
+    }
+    acc += rate;
+    uint8_t n = acc >> 4;
+    acc &= 15;
+    if (!n) {
+      return false;
+    }
+    if (target > pwm) {
+      pwm = target - pwm > n ? pwm + n : target;
+    }
+    else {
+      pwm = pwm - target > n ? pwm - n : target;
+    }
+    return true;
+  }
+};
+
+// Supply voltage compensation, for hardware that can measure VCC.
+// The PWM's mean voltage is the duty times VCC, so as a battery sags
+// the fan slows for the same setting.  reading() takes a measurement
+// that's v_nom at the nominal VCC, and scale() then scales the duty
+// by v_nom / v, up as far as 0xFF or down if VCC is high.  gain is
+// 1.7 fixed point, 128 for 1, so the division is only done once a
+// reading, and the multiply only when the duty or gain changes.  The
+// winding current stops each period at low duty, so the speed follows
+// VCC more closely than the mean does, and this takes out about half
+// of the change; host/supply has the figures.
+
+struct Supply
+{
+  uint8_t gain;
+  uint8_t in;			// The last duty scaled,
+  uint8_t out;			// and what it came to.
+
+  void
+  reading(uint8_t v, uint8_t v_nom)
+  {
+    uint16_t g = v ? ((uint16_t)v_nom << 7) / v : 0xFF;
+    gain = g > 0xFF ? 0xFF : g;
+    out = multiply(in);
+  }
+
+  uint8_t
+  scale(uint8_t pwm)
+  {
+    if (pwm != in) {
+      in = pwm;
+      out = multiply(pwm);
+    }
+    return out;
+  }
+
+  // The same without the cache, for interrupts, which would race the
+  // main loop's scale().
+  uint8_t
+  multiply(uint8_t pwm) const
+  {
+    uint16_t p = ((uint16_t)pwm * gain + 64) >> 7;
+    return p > 0xFF ? 0xFF : p;
+  }
+};
+
+// Remote control from a host over a serial line, for hardware with
+// one.  A command is a letter and, for all but 'q', an argument byte:
+//
+//   'd' duty   the manual mode setting, as if from the knob
+//   'r' rate   the random mode ramp rate, likewise
+//   'm' mode   remote_off hands back to the switch and knob
+//   'q'        query, which the hardware policy answers
+//
+// Bytes go to receive() as they arrive, which says when one completes
+// a command.  Anything else where a letter should be is dropped, so a
+// stray byte only costs the command it lands in.  While mode isn't
+// remote_off the policy's switch_on() and read_adc() answer from
+// here instead of the pins.
+
+enum RemoteMode : uint8_t
+{
+  remote_off,
+  remote_manual,
+  remote_random,
+};
+
+struct Remote
+{
+  uint8_t mode;
+  uint8_t duty;
+  uint8_t rate;
+  uint8_t op;			// The letter waiting for its argument.
+
+  // Returns the letter of the command b completes, or 0.
+  uint8_t
+  receive(uint8_t b)
+  {
+    uint8_t c = op;
+    op = 0;
+    switch (c) {
+    case 0:
+      if (b == 'd' || b == 'r' || b == 'm') {
+	op = b;
+      }
+      return b == 'q' ? b : 0;
+    case 'd':
+      duty = b;
+      break;
+    case 'r':
+      rate = b;
+      break;
+    case 'm':
+      if (b > remote_random) {
+	return 0;
+      }
+      mode = b;
+      break;
+    }
+    return c;
+  }
+
+  bool
+  switch_on(bool pin) const
+  {
+    return mode == remote_off ? pin : mode == remote_random;
+  }
+
+  uint8_t
+  knob(uint8_t adc) const
+  {
+    return mode == remote_off ? adc : mode == remote_manual ? duty : rate;
+  }
+};
+
+template <bool> struct Tag {};
+
+// A knob reading with hysteresis, for the tick scheduler, whose
+// manual mode only rescales and writes the PWM when the reading
+// changes.  A still knob's conversions can flicker between two
+// counts, so a reading that turns back against the last change has to
+// go more than band counts to be taken.  One carrying on the same way
+// is taken straight off, so every position can still be reached.
+
+struct Knob
+{
+  static constexpr uint8_t band = 1;
+
+  uint8_t level;
+  bool up;
+
+  // Returns the reading to use for in.
+  uint8_t
+  reading(uint8_t in)
+  {
+    if (in != level) {
+      bool rise = in > level;
+      uint8_t d = rise ? in - level : level - in;
+      if (rise == up || d > band) {
+	level = in;
+	up = rise;
+      }
+    }
+    return level;
+  }
+};
+
+// The tick scheduler's tasks, in the order they run on a tick when
+// more than one is due.
+enum Task : uint8_t
+{
+  task_adc,			// Read the knob.
+  task_switch,			// Follow the mode switch.
+  task_pwm,			// Copy the knob, or step the ramp.
+  task_telemetry,		// Publish the state.
+  ntasks
+};
+
+// Each task's period in Timer0 overflows, 293 a second.
+static const uint8_t task_periods[ntasks] = {
+  1,				// Tuning::knob_period in manual mode.
+  3,				// Every 10ms, which debounces it.
+  1,				// OCR0A only latches once a period.
+  255,				// About once a second.
+};
+
+// What task_telemetry publishes.
+struct Telemetry
+{
+  uint8_t pwm;
+  uint8_t adc;
+  bool on;
+};
+
+// Profiling regions.  Spiro tells the hardware policy which one it's
+// in, and a profiling build puts the number on spare pins for
+// host/profile to read back out of a trace.  Otherwise mark() and
+// unmark() are empty and compile out.  Regions nest; mark_main is
+// everything outside them.
+
+enum Mark : uint8_t
+{
+  mark_main,
+  mark_adc,			// read_adc()
+  mark_scale,			// scale_pwm()
+  mark_pwm,			// set_pwm()
+  mark_step,			// A ramp time step.
+  mark_wait,			// Waiting between time steps.
+  mark_mode,			// The startup kick and switch changes.
+  mark_isr,			// The Timer0 overflow interrupt.
+  nmarks
+};
+
+// A region from construction to the end of the scope.
+template <class Hw>
+class Marker
+{
+public:
+  Marker(Hw& hw, uint8_t m)
+    : hw(hw), saved(hw.mark(m))
+  {
+  }
+
+  ~Marker()
+  {
+    hw.unmark(saved);
+  }
+
+private:
+  Hw& hw;
+  uint8_t saved;
+};
+
+template <class Hw, class Tuning = DefaultTuning>
+class Spiro
+{
+public:
+  explicit
+  Spiro(Hw& hw, Tuning tuning = Tuning())
+    : hw(hw), tuning(tuning)
+  {
+  }
+
+  void
+  run()
+  {
+    hw.init();
+
+    uint16_t rnd;
+    uint8_t pwm = 0xFF;
+    {
+      Marker<Hw> m(hw, mark_mode);
+      rnd = boot(Tag<Hw::fast_boot>());
+      calibrate(rnd >> 8);
+    }
+
+    loop(rnd, pwm, Tag<Hw::sched>());
+  }
+
+private:
+  Hw& hw;
+  Tuning tuning;
+
+  // The main loop, polling the switch and knob as fast as it can.
+
+  void
+  loop(uint16_t rnd, uint8_t pwm, Tag<false>)
+  {
+    bool was_on = false;
+    for (;;) {
+      bool on = hw.switch_on();
+      if (on != was_on) {
+	// Only there to be seen by profiling.
+	Marker<Hw> m(hw, mark_mode);
+	was_on = on;
+      }
+      if (!on) {
+	// Switch is off, copy ADC to PWM.
+	uint8_t adc = read_adc();
+	rnd += adc;
+	pwm = scale(adc);
+	set_pwm(pwm);
+      }
+      else {
+	// Switch is on.  Ramp between random pwm values with ramp rate
+	// controlled by ADC.
+
+	rnd = next_random(rnd);
+	ramp(pwm, scale(rnd >> 8), Tag<Hw::isr_ramp>());
+      }
+    }
+  }
+
+  // The same as a cooperative scheduler.  Each Timer0 overflow runs
+  // the tasks that are due, each to completion, and then it sleeps
+  // until the next.  A tick that comes while the tasks are running
+  // is taken as soon as they finish, but if two come they only run
+  // once for both.
+  // Ramps are IsrRamp's, stepped by task_pwm instead of the interrupt.
+  // The hardware policy supplies
+  //
+  //   void sleep_tick()                  until the next overflow
+  //   void telemetry(const Telemetry&)  publish the state
+  //   void task(uint8_t)                 the Task about to run, or
+  //                                      ntasks for the dispatch, for
+  //                                      the host's per-task load
+
+  struct State
+  {
+    uint16_t rnd;
+    uint8_t adc;
+    bool on;
+    bool moved;			// adc is new to manual mode.
+    IsrRamp ramp;		// line.ip is 0 between ramps.
+  };
+
+  void
+  loop(uint16_t rnd, uint8_t pwm, Tag<true>)
+  {
+    State s = {};
+    s.rnd = rnd;
+    s.moved = true;
+    s.ramp.line.pwm = pwm;
+
+    uint8_t left[ntasks];
+    for (uint8_t t = 0; t < ntasks; t++) {
+      left[t] = 1;
+    }
+    for (;;) {
+      hw.task(ntasks);
+      {
+	Marker<Hw> m(hw, mark_wait);
+	hw.sleep_tick();
+      }
+      for (uint8_t t = 0; t < ntasks; t++) {
+	if (--left[t] == 0) {
+	  left[t] = t == task_adc && !s.on ? tuning.knob_period
+	    : task_periods[t];
+	  hw.task(t);
+	  run_task(s, t);
+	}
+      }
+    }
+  }
+
+  void
+  run_task(State& s, uint8_t t)
+  {
+    switch (t) {
+    case task_adc: {
+      uint8_t adc = read_adc();
+      if (!s.on) {
+	s.rnd += adc;
+	s.moved = s.moved || adc != s.adc;
+      }
+      s.adc = adc;
+      break;
+    }
+    case task_switch:
+      switch_task(s);
+      break;
+    case task_pwm:
+      pwm_task(s);
+      break;
+    case task_telemetry:
+      hw.telemetry(Telemetry{s.ramp.line.pwm, s.adc, s.on});
+      break;
+    }
+  }
+
+  void
+  switch_task(State& s)
+  {
+    Marker<Hw> m(hw, mark_mode);
+    bool on = hw.switch_on();
+    if (on != s.on) {
+      s.on = on;
+      s.moved = true;
+      s.ramp.line.ip = 0;	// Either way any ramp is over.
+    }
+  }
+
+  // Manual mode only does anything when the knob has moved, which
+  // the hardware policy's hysteresis keeps to real moves.
+
+  void
+  pwm_task(State& s)
+  {
+    if (!s.on && !s.moved) {
+      return;
+    }
+    Marker<Hw> m(hw, mark_step);
+    Line& line = s.ramp.line;
+    if (!s.on) {
+      s.moved = false;
+      line.pwm = scale(s.adc);
+      set_pwm(line.pwm);
+      return;
+    }
+    s.ramp.rate = isr_ramp_rate(s.adc);
+    if (!line.ip) {
+      // Start the next ramp with its first time step.
+      s.rnd = next_random(s.rnd);
+      line.start(line.pwm, scale(s.rnd >> 8));
+      s.ramp.t = 0;
+      s.ramp.acc = 0;
+      if (line.step()) {
+	set_pwm(line.pwm);
+      }
+    }
+    else if (s.ramp.tick()) {
+      set_pwm(line.pwm);
+    }
+  }
+
+  uint8_t
+  scale(uint8_t in)
+  {
+    Marker<Hw> m(hw, mark_scale);
+    if (hw.linear) {
+      uint8_t k = in >> 2;
+      return linear_pwm(in, hw.duty_table(k),
+			k + 1 < duty_entries ? hw.duty_table(k + 1) : 0xFF);
+    }
+    return scale_pwm(in, tuning.pwm_min);
+  }
+
+  uint8_t
+  read_adc()
+  {
+    Marker<Hw> m(hw, mark_adc);
+    return hw.read_adc();
+  }
+
+  void
+  set_pwm(uint8_t pwm)
+  {
+    Marker<Hw> m(hw, mark_pwm);
+    hw.set_pwm(pwm);
+  }
+
+  // Set the motor to full power briefly to make sure it starts up,
+  // and read the knob for the random seed.
+
+  // The spec says 30% power for two seconds should start the fan.
+  // http://www.formfactors.org/developer%5Cspecs%5Crev1_2_public.pdf
+  // section 3.2.  But we're doing wonky stuff with the voltage
+  // level, so whatever works.  The kick goes straight to the output
+  // rather than through set_pwm(), so a SLEW build doesn't spend it
+  // creeping up from 0.
+
+  uint16_t
+  boot(Tag<false>)
+  {
+    uint8_t adc = read_adc();
+    hw.kick();
+    hw.delay_ms(tuning.kick_ms);
+    return adc << 8;		/* "Entropy". */
+  }
+
+  // The same when init() has already started the PWM at full power
+  // and the first conversion, which takes twice as long as the rest.
+  // That one finishes during the kick, so the motor starts without
+  // waiting for it and the read afterwards is a normal conversion.
+
+  uint16_t
+  boot(Tag<true>)
+  {
+    hw.delay_ms(tuning.kick_ms);
+    return read_adc() << 8;
+  }
+
+  // A LINEAR build fills the duty table after the kick if it's blank,
+  // as EEPROM comes, or if the switch is on and the knob at 0 at power
+  // up.  Full speed is counted first, carrying on from the kick, then
+  // the sweep goes up from pwm_min, 65 points, each 2 or more gates.
+  // That's about three minutes with the default tuning and the fan
+  // model.  It ends at 0xFF, as the main loop expects.
+  //
+  // If the fan didn't speed up, the tach is missing or dead, and the
+  // table gets scale_pwm()'s straight line instead, so the knob still
+  // works as it would without LINEAR.
+
+  void
+  calibrate(uint8_t adc)
+  {
+    if (!hw.linear
+	|| (hw.duty_table(0) != 0xFF && (adc != 0 || !hw.switch_on()))) {
+      return;
+    }
+    uint16_t hi = speed(0xFF);
+    uint8_t d = tuning.pwm_min;
+    uint16_t c = speed(d);
+    Linearizer lin;
+    lin.start(d, c, hi);
+    if (!lin.span) {
+      for (uint8_t k = 0; k < duty_entries; k++) {
+	hw.put_duty(k, scale_pwm(k << 2, tuning.pwm_min));
+      }
+      set_pwm(0xFF);
+      return;
+    }
+    for (;;) {
+      uint8_t duty;
+      while (lin.entry(d, c, duty)) {
+	hw.put_duty(lin.k - 1, duty);
+      }
+      lin.next(d, c);
+      if (d == 0xFF) {
+	break;
+      }
+      d = d < 0xFF - tuning.calibrate_step ? d + tuning.calibrate_step : 0xFF;
+      c = speed(d);
+    }
+    while (lin.k < duty_entries) {
+      hw.put_duty(lin.k++, 0xFF);
+    }
+  }
+
+  // The tach count at duty d once the fan has settled, which is when
+  // a gate's count is within one of the last one's, or the last of
+  // settle_gates if a noisy tach never does.
+  uint16_t
+  speed(uint8_t d)
+  {
+    set_pwm(d);
+    uint16_t c = hw.tach(tuning.tach_gate);
+    uint16_t was;
+    uint8_t gates = tuning.settle_gates - 1;
+    do {
+      was = c;
+      c = hw.tach(tuning.tach_gate);
+    } while ((c > was + 1 || c + 1 < was) && --gates);
+    return c;
+  }
+
+  uint16_t
+  next_random(uint16_t rnd)
+  {
+    return (rnd << tuning.lcg_shift) + rnd + tuning.lcg_inc;
+  }
+
+  // Ramp pwm to to_pwm at a rate controlled by adc.  Higher adc =
+  // faster rate.
+
+  void
+  ramp(uint8_t& pwm, uint8_t to_pwm, Tag<false>)
+  {
+    Line line;
+    line.start(pwm, to_pwm);
+    uint8_t t = 0;
+    do {
+      {
+	Marker<Hw> m(hw, mark_step);
+	if (line.step()) {
+	  set_pwm(line.pwm);
+	}
+      }
+      wait();
+    } while (--t);
+    pwm = line.pwm;
+  }
+
+  // The same with the waits and later time steps done by the Timer0
+  // overflow interrupt.  The hardware policy supplies
+  //
+  //   void start_ramp(const Line&, uint8_t rate)  hand over to the ISR
+  //   bool ramping()                              until the ISR is done
+  //   void set_ramp_rate(uint8_t)                 IsrRamp::rate
+  //   uint8_t ramp_pwm()                          the line's final pwm
+
+  void
+  ramp(uint8_t& pwm, uint8_t to_pwm, Tag<true>)
+  {
+    Line line;
+    line.start(pwm, to_pwm);
+    {
+      Marker<Hw> m(hw, mark_step);
+      if (line.step()) {
+	set_pwm(line.pwm);
+      }
+    }
+    Marker<Hw> m(hw, mark_wait);
+    hw.start_ramp(line, isr_ramp_rate(read_adc()));
+    while (hw.ramping()) {
+      hw.set_ramp_rate(isr_ramp_rate(read_adc()));
+    }
+    pwm = hw.ramp_pwm();
+  }
+
+  // The delay between time steps.  counter is an 8.8 accumulator: it
+  // needs the low byte because adc + ramp_bias can be more than 255,
+  // but the loop test is just the sign of the high byte.
+
+  void
+  wait()
+  {
+    Marker<Hw> m(hw, mark_wait);
+    int16_t counter = tuning.ramp_counter;
+    int16_t counter_delta = (int16_t)read_adc() + tuning.ramp_bias;
+    while ((counter -= counter_delta) >= 0) {
+      hw.delay_loop_1(tuning.ramp_delay);
+    }
+  }
+};
+
+} // namespace spiro
+
+#endif // SPIRO_H